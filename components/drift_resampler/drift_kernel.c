@@ -0,0 +1,108 @@
+#include "drift_kernel.h"
+
+#include <math.h>
+
+#define DRIFT_KERNEL_PHASES     256
+#define DRIFT_KERNEL_ONE        (1 << 14)   // Q14 taps
+
+// Fractional delay filters, phase j delaying by j / DRIFT_KERNEL_PHASES, one
+// more to interpolate up to a whole frame
+static int16_t drift_kernel_taps[DRIFT_KERNEL_PHASES + 1][DRIFT_KERNEL_TAPS];
+static bool drift_kernel_ready;
+
+/*
+ * Blackman windowed sinc, normalized to unity gain at DC so that silence
+ * and DC offsets come out unchanged. Only run once, floating point is fine.
+ */
+static void drift_kernel_build(void) {
+    const int half = DRIFT_KERNEL_TAPS / 2;
+    double taps[DRIFT_KERNEL_TAPS], sum, x, w;
+    int j, k;
+
+    for (j = 0; j <= DRIFT_KERNEL_PHASES; j++) {
+        sum = 0;
+        for (k = 0; k < DRIFT_KERNEL_TAPS; k++) {
+            // tap k weighs the frame at offset k - (half - 1) from the position
+            x = k - (half - 1) - (double) j / DRIFT_KERNEL_PHASES;
+            w = 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half);
+            taps[k] = (x == 0 ? 1 : sin(M_PI * x) / (M_PI * x)) * w;
+            sum += taps[k];
+        }
+        for (k = 0; k < DRIFT_KERNEL_TAPS; k++) {
+            drift_kernel_taps[j][k] = (int16_t) lrint(taps[k] / sum * DRIFT_KERNEL_ONE);
+        }
+    }
+    drift_kernel_ready = true;
+}
+
+void drift_kernel_init(drift_kernel_t *kernel, int channels) {
+    if (!drift_kernel_ready) {
+        drift_kernel_build();
+    }
+    kernel->channels = channels;
+    kernel->index = DRIFT_KERNEL_TAPS / 2 - 1;
+    kernel->frac = 0;
+    kernel->step = 0;
+}
+
+void drift_kernel_set_ppm(drift_kernel_t *kernel, double ppm) {
+    if (ppm > DRIFT_KERNEL_MAX_PPM) {
+        ppm = DRIFT_KERNEL_MAX_PPM;
+    } else if (ppm < -DRIFT_KERNEL_MAX_PPM) {
+        ppm = -DRIFT_KERNEL_MAX_PPM;
+    }
+    // 2^32 / 10^6
+    kernel->step = (int32_t) (ppm * 4294.967296);
+}
+
+size_t drift_kernel_process(drift_kernel_t *kernel, const int16_t *in, size_t frames,
+                            int16_t *out, size_t out_frames, size_t *consumed) {
+    const int channels = kernel->channels;
+    const size_t before = DRIFT_KERNEL_TAPS / 2 - 1, after = DRIFT_KERNEL_TAPS / 2;
+    size_t index = kernel->index, produced = 0;
+    uint32_t frac = kernel->frac, next;
+    const int16_t *p, *a, *b;
+    int32_t ya, yb, y, f;
+    int c, k;
+
+    while (index + after < frames && produced < out_frames) {
+        // the two closest phases, and where the position lies between them (Q16)
+        a = drift_kernel_taps[frac >> 24];
+        b = drift_kernel_taps[(frac >> 24) + 1];
+        f = (frac >> 8) & 0xffff;
+
+        for (c = 0; c < channels; c++) {
+            p = in + (index - before) * channels + c;
+            ya = 0;
+            yb = 0;
+            for (k = 0; k < DRIFT_KERNEL_TAPS; k++, p += channels) {
+                ya += a[k] * *p;
+                yb += b[k] * *p;
+            }
+            y = ya + (int32_t) (((int64_t) (yb - ya) * f) >> 16);
+            y = (y + DRIFT_KERNEL_ONE / 2) >> 14;
+
+            if (y > INT16_MAX) {
+                y = INT16_MAX;
+            } else if (y < INT16_MIN) {
+                y = INT16_MIN;
+            }
+            *out++ = y;
+        }
+        produced++;
+
+        // advance by 1 + step, carrying into (or borrowing from) the index
+        next = frac + (uint32_t) kernel->step;
+        if (kernel->step >= 0) {
+            index += 1 + (next < frac);
+        } else {
+            index += (next < frac);
+        }
+        frac = next;
+    }
+
+    *consumed = index - before;
+    kernel->index = before;
+    kernel->frac = frac;
+    return produced;
+}
@@ -0,0 +1,219 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "audio_mem.h"
+#include "audio_element.h"
+#include "ringbuf.h"
+#include "drift_resampler.h"
+#include "drift_kernel.h"
+
+static const char *TAG = "DRIFT_RESAMPLER";
+
+#define FRAME_SIZE_MAX      (DRIFT_KERNEL_MAX_CHANNELS * sizeof(int16_t))
+// leftover frames and a partial frame, ahead of a full input read
+#define IN_BUF_SIZE         (DRIFT_RESAMPLER_BUF_SIZE + (DRIFT_KERNEL_HISTORY + 1) * FRAME_SIZE_MAX)
+// a full read resampled at the fastest ratio, with margin
+#define OUT_BUF_SIZE        (DRIFT_RESAMPLER_BUF_SIZE + DRIFT_RESAMPLER_BUF_SIZE / 1000 + 8 * FRAME_SIZE_MAX)
+
+typedef struct drift_resampler {
+    drift_kernel_t              kernel;
+    drift_resampler_skew_func   skew_ppm;
+    int                         correction_s;
+    bool                        passthrough;    // not 16 bit pcm
+    int                         rate;
+    int                         channels;
+    int                         bits;
+    int                         frame_size;
+    char                        *in;            // input not resampled yet
+    size_t                      held;           // bytes in "in"
+    int16_t                     *out;
+    double                      ppm;
+    double                      level_us;       // smoothed input buffer level
+    double                      target_us;      // level to keep, once settled
+    int64_t                     played_us;      // output since open, until settled
+} drift_resampler_t;
+
+static void _drift_resampler_reset(drift_resampler_t *dr)
+{
+    drift_kernel_init(&(dr->kernel), dr->channels);
+    // the kernel starts interpolating after a few frames of silence
+    memset(dr->in, 0, (DRIFT_KERNEL_TAPS / 2 - 1) * FRAME_SIZE_MAX);
+    dr->held = dr->passthrough ? 0 : (DRIFT_KERNEL_TAPS / 2 - 1) * dr->frame_size;
+    dr->ppm = 0;
+    dr->level_us = 0;
+    dr->target_us = 0;
+    dr->played_us = 0;
+}
+
+// Follow the sample format reported to the element
+static void _drift_resampler_configure(audio_element_handle_t self, drift_resampler_t *dr)
+{
+    audio_element_info_t info = {0};
+
+    audio_element_getinfo(self, &info);
+    dr->rate = info.sample_rates > 0 ? info.sample_rates : 44100;
+    if (info.bits == dr->bits && info.channels == dr->channels) {
+        return;
+    }
+
+    dr->bits = info.bits;
+    dr->channels = info.channels;
+    dr->passthrough = info.bits != 16 || info.channels < 1 || info.channels > DRIFT_KERNEL_MAX_CHANNELS;
+    dr->frame_size = dr->passthrough ? 1 : info.channels * sizeof(int16_t);
+    if (dr->passthrough) {
+        ESP_LOGW(TAG, "%d bits, %d channels not supported, passing through", info.bits, info.channels);
+    }
+    _drift_resampler_reset(dr);
+}
+
+/*
+ * Steer the ratio: the skew estimate gives the rate the source is produced
+ * at, the input level drift corrects what it misses (and the I2S clock
+ * error) over correction_s.
+ */
+static void _drift_resampler_steer(audio_element_handle_t self, drift_resampler_t *dr, size_t frames)
+{
+    ringbuf_handle_t rb = audio_element_get_input_ringbuf(self);
+    double bytes_per_us = (double) dr->rate * dr->frame_size / 1000000;
+    double block_us = frames * 1000000.0 / dr->rate;
+    double level_us, alpha, ppm = 0;
+
+    level_us = ((rb ? rb_bytes_filled(rb) : 0) + dr->held) / bytes_per_us;
+    alpha = block_us / (DRIFT_RESAMPLER_LEVEL_TAU_MS * 1000);
+    if (alpha > 1) {
+        alpha = 1;
+    }
+    dr->level_us += alpha * (level_us - dr->level_us);
+
+    if (dr->skew_ppm) {
+        ppm = dr->skew_ppm();
+    }
+    if (dr->played_us < DRIFT_RESAMPLER_SETTLE_MS * 1000) {
+        dr->played_us += block_us;
+        dr->target_us = dr->level_us;
+    } else {
+        ppm += (dr->level_us - dr->target_us) / dr->correction_s;
+    }
+
+    dr->ppm = ppm;
+    drift_kernel_set_ppm(&(dr->kernel), ppm);
+}
+
+static esp_err_t _drift_resampler_open(audio_element_handle_t self)
+{
+    drift_resampler_t *dr = (drift_resampler_t *)audio_element_getdata(self);
+
+    dr->bits = 0;
+    dr->channels = 0;
+    _drift_resampler_configure(self, dr);
+    return ESP_OK;
+}
+
+static esp_err_t _drift_resampler_close(audio_element_handle_t self)
+{
+    if (AEL_STATE_PAUSED != audio_element_get_state(self)) {
+        audio_element_set_byte_pos(self, 0);
+    }
+    return ESP_OK;
+}
+
+static int _drift_resampler_process(audio_element_handle_t self, char *in_buffer, int in_len)
+{
+    drift_resampler_t *dr = (drift_resampler_t *)audio_element_getdata(self);
+    size_t frames, consumed, produced;
+    int r_size, w_size;
+
+    r_size = audio_element_input(self, in_buffer, in_len);
+    if (r_size <= 0) {
+        return r_size;
+    }
+
+    _drift_resampler_configure(self, dr);
+    if (dr->passthrough) {
+        w_size = audio_element_output(self, in_buffer, r_size);
+        if (w_size > 0) {
+            audio_element_update_byte_pos(self, w_size);
+        }
+        return w_size;
+    }
+
+    memcpy(dr->in + dr->held, in_buffer, r_size);
+    dr->held += r_size;
+    frames = dr->held / dr->frame_size;
+
+    _drift_resampler_steer(self, dr, frames);
+    produced = drift_kernel_process(&(dr->kernel), (const int16_t *) dr->in, frames,
+                                    dr->out, OUT_BUF_SIZE / dr->frame_size, &consumed);
+
+    // keep the frames still needed, and any partial frame
+    dr->held -= consumed * dr->frame_size;
+    memmove(dr->in, dr->in + consumed * dr->frame_size, dr->held);
+
+    if (!produced) {
+        return r_size;
+    }
+    w_size = audio_element_output(self, (char *) dr->out, produced * dr->frame_size);
+    if (w_size > 0) {
+        audio_element_update_byte_pos(self, w_size);
+    }
+    return w_size;
+}
+
+static esp_err_t _drift_resampler_destroy(audio_element_handle_t self)
+{
+    drift_resampler_t *dr = (drift_resampler_t *)audio_element_getdata(self);
+
+    audio_free(dr->in);
+    audio_free(dr->out);
+    audio_free(dr);
+    return ESP_OK;
+}
+
+double drift_resampler_get_ppm(audio_element_handle_t self)
+{
+    drift_resampler_t *dr = (drift_resampler_t *)audio_element_getdata(self);
+
+    return dr ? dr->ppm : 0;
+}
+
+audio_element_handle_t drift_resampler_init(drift_resampler_cfg_t *config)
+{
+    AUDIO_NULL_CHECK(TAG, config, return NULL);
+
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    audio_element_handle_t el;
+
+    cfg.open = _drift_resampler_open;
+    cfg.close = _drift_resampler_close;
+    cfg.process = _drift_resampler_process;
+    cfg.destroy = _drift_resampler_destroy;
+    cfg.task_stack = config->task_stack;
+    cfg.task_prio = config->task_prio;
+    cfg.task_core = config->task_core;
+    cfg.stack_in_ext = config->stack_in_ext;
+    cfg.out_rb_size = config->out_rb_size;
+    cfg.buffer_len = DRIFT_RESAMPLER_BUF_SIZE;
+    cfg.tag = "drift_resampler";
+
+    drift_resampler_t *dr = audio_calloc(1, sizeof(drift_resampler_t));
+    AUDIO_MEM_CHECK(TAG, dr, return NULL);
+    dr->in = audio_calloc(1, IN_BUF_SIZE);
+    AUDIO_MEM_CHECK(TAG, dr->in, goto _drift_resampler_init_exit);
+    dr->out = audio_calloc(1, OUT_BUF_SIZE);
+    AUDIO_MEM_CHECK(TAG, dr->out, goto _drift_resampler_init_exit);
+
+    dr->skew_ppm = config->skew_ppm;
+    dr->correction_s = config->correction_s > 0 ? config->correction_s : DRIFT_RESAMPLER_CORRECTION_S;
+
+    el = audio_element_init(&cfg);
+    AUDIO_MEM_CHECK(TAG, el, goto _drift_resampler_init_exit);
+    audio_element_setdata(el, dr);
+    return el;
+
+_drift_resampler_init_exit:
+    audio_free(dr->in);
+    audio_free(dr->out);
+    audio_free(dr);
+    return NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef _DRIFT_KERNEL_H_
+#define _DRIFT_KERNEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed point resampling by a ratio close to 1, for clock drift correction.
+ *
+ * The read position moves by 1 + step / 2^32 input frames per output frame
+ * and samples are interpolated with a windowed sinc fractional delay filter
+ * (DRIFT_KERNEL_TAPS taps, 256 phases, linearly interpolated): at a few
+ * hundred ppm the position slides slowly across a frame, so there is never
+ * a dropped or repeated frame to hear. Interleaved 16 bit samples only.
+ *
+ * Plain C, Q14 filters; floating point is only used once to build them.
+ */
+
+#define DRIFT_KERNEL_MAX_CHANNELS   2
+#define DRIFT_KERNEL_TAPS           16
+#define DRIFT_KERNEL_HISTORY        (DRIFT_KERNEL_TAPS)     /*!< Most input frames left over by a call with enough output room */
+#define DRIFT_KERNEL_MAX_PPM        500
+
+typedef struct drift_kernel {
+    int         channels;
+    size_t      index;      /*!< Input frame the read position is after */
+    uint32_t    frac;       /*!< Position between frames "index" and "index + 1" */
+    int32_t     step;       /*!< Deviation of the position increment from one frame */
+} drift_kernel_t;
+
+/**
+ * @brief      Init the kernel at ratio 1
+ *
+ * @param      kernel    The kernel
+ * @param      channels  Interleaved channels, at most DRIFT_KERNEL_MAX_CHANNELS
+ */
+void drift_kernel_init(drift_kernel_t *kernel, int channels);
+
+/**
+ * @brief      Set the resampling ratio
+ *
+ * @param      kernel  The kernel
+ * @param      ppm     How much faster the input is consumed than the output
+ *                     is produced, clamped to DRIFT_KERNEL_MAX_PPM
+ */
+void drift_kernel_set_ppm(drift_kernel_t *kernel, double ppm);
+
+/**
+ * @brief      Resample a block of frames
+ *
+ * The block must start with the frames left over by the previous call, or
+ * initially with DRIFT_KERNEL_TAPS / 2 - 1 frames of silence. Output stops when the block cannot
+ * be interpolated any further or "out" is full.
+ *
+ * @param      kernel      The kernel
+ * @param      in          The input frames
+ * @param      frames      Number of input frames
+ * @param      out         The output frames
+ * @param      out_frames  Room in "out", in frames
+ * @param      consumed    Input frames no longer needed; the remaining ones
+ *                         are to be moved to the start of the next block
+ *
+ * @return     The number of output frames
+ */
+size_t drift_kernel_process(drift_kernel_t *kernel, const int16_t *in, size_t frames,
+                            int16_t *out, size_t out_frames, size_t *consumed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _DRIFT_RESAMPLER_H_
+#define _DRIFT_RESAMPLER_H_
+
+#include "audio_error.h"
+#include "audio_element.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Source of the clock skew estimate, in ppm, positive when the
+ *          audio source runs faster than the local clock
+ */
+typedef double (*drift_resampler_skew_func)(void);
+
+/**
+ * @brief   Drift resampler configuration
+ *
+ * The element sits between the decoder and the I2S writer and resamples
+ * 16 bit pcm by a ratio within DRIFT_KERNEL_MAX_PPM of 1, steered by the
+ * skew estimate and by how its input buffer level drifts from the level
+ * it had once settled. Other sample formats are passed through.
+ */
+typedef struct {
+    int                         out_rb_size;        /*!< Size of output ringbuffer */
+    int                         task_stack;         /*!< Task stack size */
+    int                         task_core;          /*!< Task running in core (0 or 1) */
+    int                         task_prio;          /*!< Task priority (based on freeRTOS priority) */
+    bool                        stack_in_ext;       /*!< Allocate stack on extern ram */
+    drift_resampler_skew_func   skew_ppm;           /*!< Skew estimate, NULL to only follow the buffer level */
+    int                         correction_s;       /*!< Time over which a buffer level error is corrected */
+} drift_resampler_cfg_t;
+
+#define DRIFT_RESAMPLER_TASK_STACK      (3 * 1024)
+#define DRIFT_RESAMPLER_TASK_CORE       (0)
+#define DRIFT_RESAMPLER_TASK_PRIO       (5)
+#define DRIFT_RESAMPLER_RINGBUFFER_SIZE (8 * 1024)
+#define DRIFT_RESAMPLER_BUF_SIZE        (2048)
+#define DRIFT_RESAMPLER_CORRECTION_S    (10)
+#define DRIFT_RESAMPLER_SETTLE_MS       (3000)  /*!< Output played before the buffer level is taken as target */
+#define DRIFT_RESAMPLER_LEVEL_TAU_MS    (2000)  /*!< Smoothing of the buffer level, which is filled by chunks */
+
+#define DRIFT_RESAMPLER_CFG_DEFAULT() {                 \
+    .out_rb_size    = DRIFT_RESAMPLER_RINGBUFFER_SIZE,  \
+    .task_stack     = DRIFT_RESAMPLER_TASK_STACK,       \
+    .task_core      = DRIFT_RESAMPLER_TASK_CORE,        \
+    .task_prio      = DRIFT_RESAMPLER_TASK_PRIO,        \
+    .stack_in_ext   = true,                             \
+    .skew_ppm       = NULL,                             \
+    .correction_s   = DRIFT_RESAMPLER_CORRECTION_S,     \
+}
+
+/**
+ * @brief       Create a drift resampler element
+ *
+ * @param      config The configuration
+ *
+ * @return     The audio element handle
+ */
+audio_element_handle_t drift_resampler_init(drift_resampler_cfg_t *config);
+
+/**
+ * @brief       Ratio currently applied
+ *
+ * @param      self The drift resampler element
+ *
+ * @return     How much faster the input is consumed than the output is
+ *             produced, in ppm
+ */
+double drift_resampler_get_ppm(audio_element_handle_t self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,31 +13,47 @@ void buffer_write_init(write_buffer_t *buffer, char *data, size_t size) {
 }
 
 int buffer_read_buffer(read_buffer_t *buffer, char *data, size_t size) {
-    int i;
-
     if (buffer->size - buffer->index < size) {
         return 1;
     }
 
-    for (i = 0; i < size; i++) {
-        data[i] = buffer->buffer[buffer->index++];
+    memcpy(data, buffer->buffer + buffer->index, size);
+    buffer->index += size;
+    return 0;
+}
+
+int buffer_write_buffer(write_buffer_t *buffer, const char *data, size_t size) {
+    if (buffer->size - buffer->index < size) {
+        return 1;
     }
 
+    memcpy(buffer->buffer + buffer->index, data, size);
+    buffer->index += size;
     return 0;
 }
 
-int buffer_write_buffer(write_buffer_t *buffer, const char *data, size_t size) {
-    int i;
+const char *buffer_read_reserve(read_buffer_t *buffer, size_t size) {
+    const char *data;
 
     if (buffer->size - buffer->index < size) {
-        return 1;
+        return NULL;
     }
 
-    for (i = 0; i < size; i++) {
-        buffer->buffer[buffer->index++] = data[i];
+    data = buffer->buffer + buffer->index;
+    buffer->index += size;
+    return data;
+}
+
+char *buffer_write_reserve(write_buffer_t *buffer, size_t size) {
+    char *data;
+
+    if (buffer->size - buffer->index < size) {
+        return NULL;
     }
 
-    return 0;
+    data = buffer->buffer + buffer->index;
+    buffer->index += size;
+    return data;
 }
 
 int buffer_read_uint32(read_buffer_t *buffer, uint32_t *data) {
@@ -45,10 +61,8 @@ int buffer_read_uint32(read_buffer_t *buffer, uint32_t *data) {
         return 1;
     }
 
-    *data = buffer->buffer[buffer->index++] & 0xff;
-    *data |= (buffer->buffer[buffer->index++] & 0xff) << 8;
-    *data |= (buffer->buffer[buffer->index++] & 0xff) << 16;
-    *data |= (buffer->buffer[buffer->index++] & 0xff) << 24;
+    *data = buffer_load_uint32(buffer->buffer + buffer->index);
+    buffer->index += sizeof(uint32_t);
     return 0;
 }
 
@@ -57,10 +71,8 @@ int buffer_write_uint32(write_buffer_t *buffer, uint32_t data) {
         return 1;
     }
 
-    buffer->buffer[buffer->index++] = data & 0xff;
-    buffer->buffer[buffer->index++] = (data >> 8) & 0xff;
-    buffer->buffer[buffer->index++] = (data >> 16) & 0xff;
-    buffer->buffer[buffer->index++] = (data >> 24) & 0xff;
+    buffer_store_uint32(buffer->buffer + buffer->index, data);
+    buffer->index += sizeof(uint32_t);
     return 0;
 }
 
@@ -69,8 +81,8 @@ int buffer_read_uint16(read_buffer_t *buffer, uint16_t *data) {
         return 1;
     }
 
-    *data = buffer->buffer[buffer->index++] & 0xff;
-    *data |= (buffer->buffer[buffer->index++] & 0xff) << 8;
+    *data = buffer_load_uint16(buffer->buffer + buffer->index);
+    buffer->index += sizeof(uint16_t);
     return 0;
 }
 
@@ -79,8 +91,8 @@ int buffer_write_uint16(write_buffer_t *buffer, uint16_t data) {
         return 1;
     }
 
-    buffer->buffer[buffer->index++] = data & 0xff;
-    buffer->buffer[buffer->index++] = (data >> 8) & 0xff;
+    buffer_store_uint16(buffer->buffer + buffer->index, data);
+    buffer->index += sizeof(uint16_t);
     return 0;
 }
 
@@ -107,10 +119,8 @@ int buffer_read_int32(read_buffer_t *buffer, int32_t *data) {
         return 1;
     }
 
-    *data = buffer->buffer[buffer->index++] & 0xff;
-    *data |= (buffer->buffer[buffer->index++] & 0xff) << 8;
-    *data |= (buffer->buffer[buffer->index++] & 0xff) << 16;
-    *data |= (buffer->buffer[buffer->index++] & 0xff) << 24;
+    *data = (int32_t) buffer_load_uint32(buffer->buffer + buffer->index);
+    buffer->index += sizeof(int32_t);
     return 0;
 }
 
@@ -119,10 +129,8 @@ int buffer_write_int32(write_buffer_t *buffer, int32_t data) {
         return 1;
     }
 
-    buffer->buffer[buffer->index++] = data & 0xff;
-    buffer->buffer[buffer->index++] = (data >> 8) & 0xff;
-    buffer->buffer[buffer->index++] = (data >> 16) & 0xff;
-    buffer->buffer[buffer->index++] = (data >> 24) & 0xff;
+    buffer_store_uint32(buffer->buffer + buffer->index, (uint32_t) data);
+    buffer->index += sizeof(int32_t);
     return 0;
 }
 
@@ -131,8 +139,8 @@ int buffer_read_int16(read_buffer_t *buffer, int16_t *data) {
         return 1;
     }
 
-    *data = buffer->buffer[buffer->index++] & 0xff;
-    *data |= (buffer->buffer[buffer->index++] & 0xff) << 8;
+    *data = (int16_t) buffer_load_uint16(buffer->buffer + buffer->index);
+    buffer->index += sizeof(int16_t);
     return 0;
 }
 
@@ -141,8 +149,8 @@ int buffer_write_int16(write_buffer_t *buffer, int16_t data) {
         return 1;
     }
 
-    buffer->buffer[buffer->index++] = data & 0xff;
-    buffer->buffer[buffer->index++] = (data >> 8) & 0xff;
+    buffer_store_uint16(buffer->buffer + buffer->index, (uint16_t) data);
+    buffer->index += sizeof(int16_t);
     return 0;
 }
 
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 typedef struct read_buffer_t {
     const char *buffer;
@@ -56,6 +57,79 @@ int buffer_read_buffer(read_buffer_t *buffer, char *data, size_t size);
 */
 int buffer_write_buffer(write_buffer_t *buffer, const char *data, size_t size);
 
+/**
+ * Reserve an array of bytes to read from the buffer.
+ *
+ * Checks once that "size" bytes are available and skips over them, so that a
+ * fixed layout can then be decoded with the buffer_load_* helpers without any
+ * further bounds check.
+ *
+ * @param[in] buffer The buffer to read from.
+ * @param[in] size The size of the array of bytes.
+ * @return A pointer to the reserved bytes, NULL if there are not enough bytes
+ *         to read from the buffer.
+*/
+const char *buffer_read_reserve(read_buffer_t *buffer, size_t size);
+
+/**
+ * Reserve an array of bytes to write to the buffer.
+ *
+ * Checks once that there is room for "size" bytes and skips over them, so that
+ * a fixed layout can then be encoded with the buffer_store_* helpers without
+ * any further bounds check.
+ *
+ * @param[in] buffer The buffer to write to.
+ * @param[in] size The size of the array of bytes.
+ * @return A pointer to the reserved bytes, NULL if there is not enough room in
+ *         the buffer.
+*/
+char *buffer_write_reserve(write_buffer_t *buffer, size_t size);
+
+/*
+ * Unchecked little endian loads and stores, for pointers of any alignment.
+ */
+
+static inline uint16_t buffer_load_uint16(const char *data) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+#else
+    return (data[0] & 0xff) | (data[1] & 0xff) << 8;
+#endif
+}
+
+static inline uint32_t buffer_load_uint32(const char *data) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+#else
+    return (data[0] & 0xff) | (data[1] & 0xff) << 8 |
+        (data[2] & 0xff) << 16 | (uint32_t) (data[3] & 0xff) << 24;
+#endif
+}
+
+static inline void buffer_store_uint16(char *data, uint16_t value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(data, &value, sizeof(value));
+#else
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+#endif
+}
+
+static inline void buffer_store_uint32(char *data, uint32_t value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(data, &value, sizeof(value));
+#else
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+    data[2] = (value >> 16) & 0xff;
+    data[3] = (value >> 24) & 0xff;
+#endif
+}
+
 /**
  * Read an uint32_t from the buffer.
  *
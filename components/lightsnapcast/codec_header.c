@@ -0,0 +1,132 @@
+#include "snapcast.h"
+
+#include <string.h>
+#include <buffer.h>
+
+/*
+ * Extract the sample format from the codec specific part of codec header
+ * messages.
+ */
+
+// RIFF/WAVE header, looking for the "fmt " chunk
+static int pcm_header_parse(const char *data, uint32_t size, sample_format_t *format) {
+    read_buffer_t buffer;
+    const char *header, *chunk;
+    uint32_t chunk_size;
+
+    buffer_read_init(&buffer, data, size);
+
+    header = buffer_read_reserve(&buffer, 12);
+    if (!header || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+        return 1;
+    }
+
+    while ((header = buffer_read_reserve(&buffer, 8))) {
+        chunk_size = buffer_load_uint32(header + 4);
+        chunk = buffer_read_reserve(&buffer, chunk_size);
+
+        if (!memcmp(header, "fmt ", 4)) {
+            if (!chunk || chunk_size < 16) {
+                return 1;
+            }
+            format->channels = buffer_load_uint16(chunk + 2);
+            format->rate = buffer_load_uint32(chunk + 4);
+            format->bits = buffer_load_uint16(chunk + 14);
+            return 0;
+        }
+
+        // The data chunk size is bogus in streamed headers, and chunks are
+        // padded to an even size
+        if (!chunk || buffer_read_reserve(&buffer, chunk_size & 1) == NULL) {
+            return 1;
+        }
+    }
+
+    return 1;
+}
+
+// "fLaC" marker followed by metadata blocks, STREAMINFO being the first one
+static int flac_header_parse(const char *data, uint32_t size, sample_format_t *format) {
+    const uint8_t *info = (const uint8_t *) data + 8;
+
+    // Marker, block header (type 0 is STREAMINFO) and the 34 bytes of STREAMINFO
+    if (size < 8 + 34 || memcmp(data, "fLaC", 4) || (data[4] & 0x7f) != 0) {
+        return 1;
+    }
+
+    // After the block and frame sizes: 20 bits of sample rate, 3 bits of
+    // channels - 1 and 5 bits of bits per sample - 1
+    format->rate = info[10] << 12 | info[11] << 4 | info[12] >> 4;
+    format->channels = ((info[12] >> 1) & 0x07) + 1;
+    format->bits = ((info[12] & 0x01) << 4 | info[13] >> 4) + 1;
+    return 0;
+}
+
+static int opus_header_parse(const char *data, uint32_t size, sample_format_t *format) {
+    // Snapserver pseudo header: "OPUS" marker as a little endian integer,
+    // then the sample rate, bits and channels the stream was encoded from
+    if (size >= 12 && buffer_load_uint32(data) == 0x4f505553) {
+        format->rate = buffer_load_uint32(data + 4);
+        format->bits = buffer_load_uint16(data + 8);
+        format->channels = buffer_load_uint16(data + 10);
+        return 0;
+    }
+
+    // RFC 7845 identification header, Opus always decodes to 48 kHz
+    if (size >= 19 && !memcmp(data, "OpusHead", 8)) {
+        format->rate = 48000;
+        format->bits = 16;
+        format->channels = (uint8_t) data[9];
+        return 0;
+    }
+
+    return 1;
+}
+
+// First Ogg page, carrying the Vorbis identification header
+static int ogg_header_parse(const char *data, uint32_t size, sample_format_t *format) {
+    const char *ident;
+    uint32_t start;
+
+    if (size < 27 || memcmp(data, "OggS", 4)) {
+        return 1;
+    }
+
+    // Page header, then the segment table
+    start = 27 + (uint8_t) data[26];
+    if (size < start + 16) {
+        return 1;
+    }
+
+    ident = data + start;
+    if (memcmp(ident, "\x01vorbis", 7)) {
+        return 1;
+    }
+
+    format->channels = (uint8_t) ident[11];
+    format->rate = buffer_load_uint32(ident + 12);
+    format->bits = 16;
+    return 0;
+}
+
+int codec_header_message_sample_format(const codec_header_message_t *msg, sample_format_t *format) {
+    int result;
+
+    if (strcmp(msg->codec, "pcm") == 0) {
+        result = pcm_header_parse(msg->payload, msg->size, format);
+    } else if (strcmp(msg->codec, "flac") == 0) {
+        result = flac_header_parse(msg->payload, msg->size, format);
+    } else if (strcmp(msg->codec, "opus") == 0) {
+        result = opus_header_parse(msg->payload, msg->size, format);
+    } else if (strcmp(msg->codec, "ogg") == 0) {
+        result = ogg_header_parse(msg->payload, msg->size, format);
+    } else {
+        return 1;
+    }
+
+    if (result || format->rate == 0 || format->bits == 0 || format->channels == 0) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "framer.h"
+
+#include <string.h>
+
+void framer_init(framer_t *framer, char *storage, size_t capacity) {
+    framer->storage = storage;
+    framer->capacity = capacity;
+    framer->data = NULL;
+    framer->size = 0;
+    framer->index = 0;
+    framer->received_us = 0;
+    framer_reset(framer);
+}
+
+void framer_reset(framer_t *framer) {
+    framer->fill = 0;
+    framer->skip = 0;
+}
+
+void framer_feed(framer_t *framer, const char *data, size_t size, int64_t received_us) {
+    framer->data = data;
+    framer->size = size;
+    framer->index = 0;
+    framer->received_us = received_us;
+}
+
+// Move up to "wanted" bytes of the current fragment to the reassembly area
+static size_t framer_gather(framer_t *framer, size_t wanted) {
+    size_t available = framer->size - framer->index;
+    size_t count = wanted < available ? wanted : available;
+
+    memcpy(framer->storage + framer->fill, framer->data + framer->index, count);
+    framer->fill += count;
+    framer->index += count;
+    return count;
+}
+
+int framer_next(framer_t *framer, message_frame_t *frame) {
+    size_t available, total;
+
+    if (framer->skip) {
+        available = framer->size - framer->index;
+        if (available < framer->skip) {
+            framer->skip -= available;
+            framer->index = framer->size;
+            return 1;
+        }
+        framer->index += framer->skip;
+        framer->skip = 0;
+    }
+
+    available = framer->size - framer->index;
+
+    if (framer->fill == 0 && available >= BASE_MESSAGE_SIZE) {
+        // Fast path: the whole message sits in the fragment, hand out a view
+        // on it without copying anything. Oversized messages go through the
+        // slow path too, so that they are dropped however they are split.
+        base_message_deserialize(&(frame->base), framer->data + framer->index, available);
+        if (frame->base.size <= available - BASE_MESSAGE_SIZE
+            && frame->base.size <= framer->capacity - BASE_MESSAGE_SIZE) {
+            frame->payload = framer->data + framer->index + BASE_MESSAGE_SIZE;
+            frame->received_us = framer->received_us;
+            framer->index += BASE_MESSAGE_SIZE + frame->base.size;
+            return 0;
+        }
+    }
+
+    // Slow path: the message spans fragments, reassemble it
+    if (framer->fill == 0) {
+        framer->start_us = framer->received_us;
+    }
+    if (framer->fill < BASE_MESSAGE_SIZE) {
+        framer_gather(framer, BASE_MESSAGE_SIZE - framer->fill);
+        if (framer->fill < BASE_MESSAGE_SIZE) {
+            return 1;
+        }
+        base_message_deserialize(&(framer->base), framer->storage, BASE_MESSAGE_SIZE);
+
+        if (framer->base.size > framer->capacity - BASE_MESSAGE_SIZE) {
+            frame->base = framer->base;
+            frame->payload = NULL;
+            frame->received_us = framer->start_us;
+            framer->fill = 0;
+            framer->skip = framer->base.size;
+            return 2;
+        }
+    }
+
+    total = BASE_MESSAGE_SIZE + framer->base.size;
+    framer_gather(framer, total - framer->fill);
+    if (framer->fill < total) {
+        return 1;
+    }
+
+    frame->base = framer->base;
+    frame->payload = framer->storage + BASE_MESSAGE_SIZE;
+    frame->received_us = framer->start_us;
+    // The storage is only reused on the next call, which is when the payload
+    // view stops being valid
+    framer->fill = 0;
+    return 0;
+}
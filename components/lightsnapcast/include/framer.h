@@ -0,0 +1,89 @@
+#ifndef __FRAMER_H__
+#define __FRAMER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "snapcast.h"
+
+/**
+ * A complete snapcast message: its decoded base header and a view on its
+ * payload.
+ *
+ * The payload either points into the fragment given to framer_feed() (when
+ * the whole message was contiguous in it) or into the framer reassembly
+ * storage. In both cases it is only valid until the next call to
+ * framer_feed() or framer_next().
+ */
+typedef struct message_frame {
+    base_message_t base;
+    const char *payload;
+    int64_t received_us;    // arrival time of the fragment the message started in
+} message_frame_t;
+
+/**
+ * Streaming splitter turning arbitrary byte fragments into complete messages.
+ */
+typedef struct framer {
+    char *storage;          // reassembly area, owned by the caller
+    size_t capacity;
+    size_t fill;            // bytes of the current message held in storage
+    uint32_t skip;          // payload bytes still to drop for an oversized message
+    base_message_t base;    // header of the message being reassembled
+    int64_t start_us;       // arrival time of its first bytes
+    const char *data;       // current fragment
+    size_t size, index;
+    int64_t received_us;    // arrival time of the current fragment
+} framer_t;
+
+/**
+ * Init the framer.
+ *
+ * The caller owns the memory pointed to by "storage". It is only used for
+ * messages spanning several fragments, but its size bounds the largest
+ * message returned (base header included) however the stream is split:
+ * larger ones are always dropped, see framer_next().
+ *
+ * @param[in] framer The framer to initialize.
+ * @param[in] storage The reassembly area.
+ * @param[in] capacity The size of the reassembly area.
+ */
+void framer_init(framer_t *framer, char *storage, size_t capacity);
+
+/**
+ * Drop any partially received message.
+ *
+ * @param[in] framer The framer to reset.
+ */
+void framer_reset(framer_t *framer);
+
+/**
+ * Hand a new fragment of the stream to the framer.
+ *
+ * framer_next() must have returned 1 for the previous fragment, ie. all of its
+ * bytes must have been consumed. The fragment must stay valid until then.
+ *
+ * The arrival time is only carried over to the messages, in whatever time
+ * base the caller uses. It should be taken as close to the socket read as
+ * possible, since it is the receive time of Time messages.
+ *
+ * @param[in] framer The framer to feed.
+ * @param[in] data The received bytes.
+ * @param[in] size The number of received bytes.
+ * @param[in] received_us The arrival time of the bytes.
+ */
+void framer_feed(framer_t *framer, const char *data, size_t size, int64_t received_us);
+
+/**
+ * Extract the next complete message.
+ *
+ * @param[in] framer The framer to read from.
+ * @param[out] frame The extracted message.
+ * @return 0 if a message was extracted, 1 if more data is needed, 2 if a
+ *         message too large for the reassembly area was dropped (only its
+ *         base header is filled in "frame").
+ */
+int framer_next(framer_t *framer, message_frame_t *frame);
+
+#endif // __FRAMER_H__
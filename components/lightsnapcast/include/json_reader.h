@@ -0,0 +1,101 @@
+#ifndef __JSON_READER_H__
+#define __JSON_READER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Minimal single pass JSON tokenizer.
+ *
+ * It works in place on the (not necessarily null terminated) input and never
+ * allocates: tokens are views on the input, and nested values are skipped
+ * over as a whole unless a reader is explicitly started on them.
+ */
+
+typedef enum json_type {
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL,
+    JSON_OBJECT,
+    JSON_ARRAY,
+} json_type_t;
+
+typedef struct json_token {
+    json_type_t type;
+    const char *start;  // strings: the raw contents between the quotes
+    size_t size;
+} json_token_t;
+
+typedef struct json_reader {
+    const char *data;
+    size_t size, index;
+} json_reader_t;
+
+/**
+ * Init the reader.
+ *
+ * @param[in] reader The reader to initialize.
+ * @param[in] data The JSON text, or a token of type JSON_OBJECT or JSON_ARRAY.
+ * @param[in] size The size of the JSON text.
+ */
+void json_reader_init(json_reader_t *reader, const char *data, size_t size);
+
+/**
+ * Enter the object or array starting at the reader position.
+ *
+ * @param[in] reader The reader.
+ * @param[in] type JSON_OBJECT or JSON_ARRAY.
+ * @return 0 on success, 2 if the input does not start with such a value.
+ */
+int json_reader_enter(json_reader_t *reader, json_type_t type);
+
+/**
+ * Read the next member of the entered object.
+ *
+ * @param[in] reader The reader.
+ * @param[out] key The member name.
+ * @param[out] value The member value.
+ * @return 0 if a member was read, 1 at the end of the object, 2 on malformed input.
+ */
+int json_reader_next_member(json_reader_t *reader, json_token_t *key, json_token_t *value);
+
+/**
+ * Read the next element of the entered array.
+ *
+ * @param[in] reader The reader.
+ * @param[out] value The element value.
+ * @return 0 if an element was read, 1 at the end of the array, 2 on malformed input.
+ */
+int json_reader_next_element(json_reader_t *reader, json_token_t *value);
+
+/**
+ * Compare a string token with a C string, without unescaping.
+ */
+bool json_token_equals(const json_token_t *token, const char *str);
+
+/**
+ * Convert a number token to an integer, ignoring any fractional part or
+ * exponent and saturating out of range values.
+ *
+ * @return 0 on success, 1 if the token is not a number.
+ */
+int json_token_to_int(const json_token_t *token, int32_t *value);
+
+/**
+ * Unescape a string token.
+ *
+ * The output is always null terminated. It is truncated if needed, never in
+ * the middle of an UTF-8 sequence.
+ *
+ * @param[in] token The string token.
+ * @param[out] out The output buffer.
+ * @param[in] size The size of the output buffer, must not be 0.
+ * @param[out] length The length of the unescaped string, without terminator.
+ * @return 1 if the output was truncated, 0 otherwise.
+ */
+int json_token_unescape(const json_token_t *token, char *out, size_t size, size_t *length);
+
+#endif // __JSON_READER_H__
@@ -0,0 +1,51 @@
+#ifndef __MESSAGE_BUILDER_H__
+#define __MESSAGE_BUILDER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <buffer.h>
+
+#include "snapcast.h"
+
+/**
+ * Outbound message being serialized as one contiguous frame.
+ *
+ * Room for the base header is reserved up front and the payload serializers
+ * append to "buffer" right after it. The header is only written when the
+ * frame is finished, once the payload size is known, so that the whole
+ * message can go out in a single transport write.
+ */
+typedef struct message_builder {
+    write_buffer_t buffer;
+    uint16_t type;
+    uint16_t refersTo;
+} message_builder_t;
+
+/**
+ * Start a new frame.
+ *
+ * @param[in] builder The builder to initialize.
+ * @param[out] data The array of bytes receiving the frame.
+ * @param[in] size The size of the array of bytes.
+ * @param[in] type The message type.
+ * @param[in] refersTo The id of the message this one answers, 0 if none.
+ * @return 1 if there is not enough room for the base header, 0 otherwise.
+ */
+int message_builder_begin(message_builder_t *builder, char *data, size_t size, uint16_t type, uint16_t refersTo);
+
+/**
+ * Write the base header of the frame.
+ *
+ * The size is taken from the serialized payload, "received" is left to 0.
+ * This should be called right before sending so that "sent" is accurate.
+ *
+ * @param[in] builder The builder.
+ * @param[in] id The message id.
+ * @param[in] sent The send time.
+ * @param[out] length The size of the whole frame.
+ * @return 1 if the header could not be written, 0 otherwise.
+ */
+int message_builder_finish(message_builder_t *builder, uint16_t id, tv_t sent, size_t *length);
+
+#endif // __MESSAGE_BUILDER_H__
@@ -0,0 +1,88 @@
+#ifndef __MESSAGE_SCHEMA_H__
+#define __MESSAGE_SCHEMA_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <buffer.h>
+
+/*
+ * Declarative description of fixed-layout messages.
+ *
+ * A message layout is written once as an X-macro listing its fields in wire
+ * order, FIELD(struct type, member, wire type):
+ *
+ *   #define TIME_MESSAGE_FIELDS(FIELD) \
+ *       FIELD(time_message_t, latency.sec, int32) \
+ *       FIELD(time_message_t, latency.usec, int32)
+ *
+ * From that list, MESSAGE_SCHEMA_SIZE gives the serialized size as a constant
+ * expression and MESSAGE_SCHEMA_DEFINE generates the codec functions
+ * declared by MESSAGE_SCHEMA_DECLARE:
+ *
+ *   int name_encode(const struct type *msg, write_buffer_t *buffer);
+ *   int name_decode(struct type *msg, read_buffer_t *buffer);
+ *
+ * Both check the bounds once with buffer_*_reserve, then load or store each
+ * field in straight-line code, and return 1 if the buffer is too short, 0
+ * otherwise. A member whose size differs from its wire type fails to
+ * compile.
+ */
+
+// Serialized size of each wire type, all little endian
+#define MESSAGE_FIELD_SIZE_uint16 2
+#define MESSAGE_FIELD_SIZE_int32 4
+#define MESSAGE_FIELD_SIZE_uint32 4
+
+#define MESSAGE_FIELD_LOAD_uint16(data) buffer_load_uint16(data)
+#define MESSAGE_FIELD_LOAD_int32(data) (int32_t) buffer_load_uint32(data)
+#define MESSAGE_FIELD_LOAD_uint32(data) buffer_load_uint32(data)
+
+#define MESSAGE_FIELD_STORE_uint16(data, value) buffer_store_uint16(data, value)
+#define MESSAGE_FIELD_STORE_int32(data, value) buffer_store_uint32(data, (uint32_t) (value))
+#define MESSAGE_FIELD_STORE_uint32(data, value) buffer_store_uint32(data, value)
+
+#define MESSAGE_FIELD_ADD_SIZE(msg_type, member, type) + MESSAGE_FIELD_SIZE_##type
+
+#define MESSAGE_FIELD_CHECK(msg_type, member, type)                           \
+    _Static_assert(sizeof(((msg_type *) 0)->member) == MESSAGE_FIELD_SIZE_##type, \
+                   #msg_type "." #member " is not a " #type);
+
+#define MESSAGE_FIELD_ENCODE(msg_type, member, type)                          \
+    MESSAGE_FIELD_CHECK(msg_type, member, type)                               \
+    MESSAGE_FIELD_STORE_##type(data, msg->member);                            \
+    data += MESSAGE_FIELD_SIZE_##type;
+
+#define MESSAGE_FIELD_DECODE(msg_type, member, type)                          \
+    MESSAGE_FIELD_CHECK(msg_type, member, type)                               \
+    msg->member = MESSAGE_FIELD_LOAD_##type(data);                            \
+    data += MESSAGE_FIELD_SIZE_##type;
+
+#define MESSAGE_SCHEMA_SIZE(FIELDS) (0 FIELDS(MESSAGE_FIELD_ADD_SIZE))
+
+#define MESSAGE_SCHEMA_DECLARE(name, msg_type)                                \
+    int name##_encode(const msg_type *msg, write_buffer_t *buffer);           \
+    int name##_decode(msg_type *msg, read_buffer_t *buffer)
+
+#define MESSAGE_SCHEMA_DEFINE(name, msg_type, FIELDS)                         \
+    int name##_encode(const msg_type *msg, write_buffer_t *buffer) {          \
+        char *data = buffer_write_reserve(buffer, MESSAGE_SCHEMA_SIZE(FIELDS)); \
+                                                                               \
+        if (!data) {                                                           \
+            return 1;                                                          \
+        }                                                                      \
+        FIELDS(MESSAGE_FIELD_ENCODE)                                           \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    int name##_decode(msg_type *msg, read_buffer_t *buffer) {                 \
+        const char *data = buffer_read_reserve(buffer, MESSAGE_SCHEMA_SIZE(FIELDS)); \
+                                                                               \
+        if (!data) {                                                           \
+            return 1;                                                          \
+        }                                                                      \
+        FIELDS(MESSAGE_FIELD_DECODE)                                           \
+        return 0;                                                              \
+    }
+
+#endif // __MESSAGE_SCHEMA_H__
@@ -5,6 +5,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "message_schema.h"
+
 enum message_type {
     SNAPCAST_MESSAGE_BASE = 0,
     SNAPCAST_MESSAGE_CODEC_HEADER = 1,
@@ -32,8 +34,21 @@ typedef struct base_message {
     uint32_t size;
 } base_message_t;
 
-extern const int BASE_MESSAGE_SIZE;
-extern const int TIME_MESSAGE_SIZE;
+#define BASE_MESSAGE_FIELDS(FIELD)            \
+    FIELD(base_message_t, type, uint16)       \
+    FIELD(base_message_t, id, uint16)         \
+    FIELD(base_message_t, refersTo, uint16)   \
+    FIELD(base_message_t, sent.sec, int32)    \
+    FIELD(base_message_t, sent.usec, int32)   \
+    FIELD(base_message_t, received.sec, int32) \
+    FIELD(base_message_t, received.usec, int32) \
+    FIELD(base_message_t, size, uint32)
+
+enum {
+    BASE_MESSAGE_SIZE = MESSAGE_SCHEMA_SIZE(BASE_MESSAGE_FIELDS)
+};
+
+MESSAGE_SCHEMA_DECLARE(base_message, base_message_t);
 
 int base_message_serialize(base_message_t *msg, char *data, uint32_t size);
 
@@ -65,7 +80,11 @@ typedef struct hello_message {
     int protocol_version;
 } hello_message_t;
 
-char* hello_message_serialize(hello_message_t* msg, size_t *size);
+/*
+ * Write the length prefixed JSON payload of the hello message to the buffer,
+ * without any allocation. Returns 1 if the buffer is too small.
+ */
+int hello_message_serialize(hello_message_t *msg, write_buffer_t *buffer);
 
 typedef struct server_settings_message {
     int32_t buffer_ms;
@@ -74,7 +93,8 @@ typedef struct server_settings_message {
     bool muted;
 } server_settings_message_t;
 
-int server_settings_message_deserialize(server_settings_message_t *msg, const char *json_str);
+// Parses the length prefixed JSON payload in place, without allocating
+int server_settings_message_deserialize(server_settings_message_t *msg, const char *data, uint32_t size);
 
 typedef struct codec_header_message {
    char *codec;
@@ -85,24 +105,116 @@ typedef struct codec_header_message {
 int codec_header_message_deserialize(codec_header_message_t *msg, const char *data, uint32_t size);
 void codec_header_message_free(codec_header_message_t *msg);
 
+typedef struct sample_format {
+    uint32_t rate;
+    uint16_t bits;
+    uint16_t channels;
+} sample_format_t;
+
+/*
+ * Read the sample format from the codec specific header (RIFF header for
+ * pcm, STREAMINFO for flac, snapserver or OpusHead header for opus, Vorbis
+ * identification header for ogg). Returns 1 if the codec is unknown or the
+ * header malformed.
+ */
+int codec_header_message_sample_format(const codec_header_message_t *msg, sample_format_t *format);
+
+/*
+ * Audio data owned by a single holder, carried in the same allocation. It
+ * changes hands by moving the pointer, the jitter buffer for instance takes
+ * the chunks pushed to it.
+ */
+typedef struct chunk_buffer {
+    const char *data;
+    uint32_t size;
+} chunk_buffer_t;
+
+// Allocate a chunk holding a copy of data
+chunk_buffer_t *chunk_buffer_copy(const char *data, uint32_t size);
+void chunk_buffer_free(chunk_buffer_t *chunk);
+
 typedef struct wire_chunk_message {
     tv_t timestamp;
     uint32_t size;
-    char *payload;
+    const char *payload;
+    chunk_buffer_t *chunk;
 } wire_chunk_message_t;
 
-// TODO currently copies, could be made to not copy probably
+// Only the header of wire chunks has a fixed layout, the payload follows it
+#define WIRE_CHUNK_HEADER_FIELDS(FIELD)                 \
+    FIELD(wire_chunk_message_t, timestamp.sec, int32)   \
+    FIELD(wire_chunk_message_t, timestamp.usec, int32)  \
+    FIELD(wire_chunk_message_t, size, uint32)
+
+enum {
+    WIRE_CHUNK_HEADER_SIZE = MESSAGE_SCHEMA_SIZE(WIRE_CHUNK_HEADER_FIELDS)
+};
+
+MESSAGE_SCHEMA_DECLARE(wire_chunk_header, wire_chunk_message_t);
+
+/*
+ * The deserialized payload is a view on "data" (chunk is NULL), only valid as
+ * long as "data" is. Call wire_chunk_message_own to keep the chunk around
+ * longer; payload then points into msg->chunk, which the message owns.
+ * Returns 2 if the copy cannot be allocated, the view is then left as is.
+ */
 int wire_chunk_message_deserialize(wire_chunk_message_t *msg, const char *data, uint32_t size);
+int wire_chunk_message_own(wire_chunk_message_t *msg);
+// Free the chunk the message owns, never a borrowed payload
 void wire_chunk_message_free(wire_chunk_message_t *msg);
 
 typedef struct time_message {
     tv_t latency;
 } time_message_t;
 
-int time_message_serialize(time_message_t *msg, char *data, uint32_t size);
-int time_message_deserialize(time_message_t *msg, const char *data, uint32_t size);
+#define TIME_MESSAGE_FIELDS(FIELD)                  \
+    FIELD(time_message_t, latency.sec, int32)       \
+    FIELD(time_message_t, latency.usec, int32)
 
+enum {
+    TIME_MESSAGE_SIZE = MESSAGE_SCHEMA_SIZE(TIME_MESSAGE_FIELDS)
+};
+
+MESSAGE_SCHEMA_DECLARE(time_message, time_message_t);
 
+int time_message_serialize(time_message_t *msg, char *data, uint32_t size);
+int time_message_deserialize(time_message_t *msg, const char *data, uint32_t size);
 
+#define STREAM_TAGS_ARENA_SIZE 768
+#define STREAM_TAGS_FIELD_MAX  256
+
+/*
+ * Stream metadata, stored in a fixed size arena.
+ *
+ * The fields point into the arena and are "" when absent. Each field is
+ * stored in order of appearance, truncated to STREAM_TAGS_FIELD_MAX bytes and
+ * to the room left in the arena (never in the middle of an UTF-8 sequence),
+ * in which case "truncated" is set. A truncated URL is of no use, an art URL
+ * that does not fit is dropped instead, setting "truncated" as well. Arrays
+ * of strings (MPRIS artists) are joined with ", ".
+ */
+typedef struct stream_tags_message {
+    const char *title;
+    const char *artist;
+    const char *album;
+    const char *art_url;
+    bool truncated;
+    uint32_t hash;          // hash of the raw payload the tags come from
+    uint32_t payload_size;
+    char arena[STREAM_TAGS_ARENA_SIZE];
+} stream_tags_message_t;
+
+void stream_tags_message_init(stream_tags_message_t *msg);
+// Whether the raw payload differs from the one the tags were parsed from
+bool stream_tags_message_changed(stream_tags_message_t *msg, const char *data, uint32_t size);
+/*
+ * Parses the length prefixed JSON payload into "scratch", without allocating,
+ * and only then copies it to msg: a malformed payload returns 1 and leaves
+ * the tags msg already holds as they were.
+ */
+int stream_tags_message_deserialize(stream_tags_message_t *msg, stream_tags_message_t *scratch,
+                                    const char *data, uint32_t size);
+// Copy tags, rebasing the fields on the arena of the copy
+void stream_tags_message_copy(stream_tags_message_t *dst, const stream_tags_message_t *src);
 
 #endif // __SNAPCAST_H__
@@ -0,0 +1,372 @@
+#include "json_reader.h"
+
+#include <string.h>
+
+void json_reader_init(json_reader_t *reader, const char *data, size_t size) {
+    reader->data = data;
+    reader->size = size;
+    reader->index = 0;
+}
+
+static void json_skip_whitespace(json_reader_t *reader) {
+    char c;
+
+    while (reader->index < reader->size) {
+        c = reader->data[reader->index];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            break;
+        }
+        reader->index++;
+    }
+}
+
+// Read the string starting at the reader position (on the opening quote)
+static int json_read_string(json_reader_t *reader, json_token_t *token) {
+    size_t start = ++reader->index;
+    char c;
+
+    while (reader->index < reader->size) {
+        c = reader->data[reader->index];
+        if (c == '\\') {
+            reader->index += 2;
+            continue;
+        }
+        if (c == '"') {
+            token->type = JSON_STRING;
+            token->start = reader->data + start;
+            token->size = reader->index - start;
+            reader->index++;
+            return 0;
+        }
+        reader->index++;
+    }
+
+    return 2;
+}
+
+// Skip over the object or array starting at the reader position
+static int json_read_nested(json_reader_t *reader, json_token_t *token) {
+    size_t start = reader->index;
+    json_token_t ignored;
+    int depth = 0;
+    char c;
+
+    while (reader->index < reader->size) {
+        c = reader->data[reader->index];
+        if (c == '"') {
+            if (json_read_string(reader, &ignored)) {
+                return 2;
+            }
+            continue;
+        }
+
+        reader->index++;
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                token->type = reader->data[start] == '{' ? JSON_OBJECT : JSON_ARRAY;
+                token->start = reader->data + start;
+                token->size = reader->index - start;
+                return 0;
+            }
+        }
+    }
+
+    return 2;
+}
+
+static int json_read_literal(json_reader_t *reader, json_token_t *token, const char *literal, json_type_t type) {
+    size_t size = strlen(literal);
+
+    if (reader->size - reader->index < size ||
+            memcmp(reader->data + reader->index, literal, size)) {
+        return 2;
+    }
+
+    token->type = type;
+    token->start = reader->data + reader->index;
+    token->size = size;
+    reader->index += size;
+    return 0;
+}
+
+static int json_read_number(json_reader_t *reader, json_token_t *token) {
+    size_t start = reader->index;
+    char c;
+
+    while (reader->index < reader->size) {
+        c = reader->data[reader->index];
+        if ((c < '0' || c > '9') && c != '-' && c != '+' && c != '.' && c != 'e' && c != 'E') {
+            break;
+        }
+        reader->index++;
+    }
+
+    token->type = JSON_NUMBER;
+    token->start = reader->data + start;
+    token->size = reader->index - start;
+    return 0;
+}
+
+static int json_read_value(json_reader_t *reader, json_token_t *token) {
+    char c;
+
+    json_skip_whitespace(reader);
+    if (reader->index >= reader->size) {
+        return 2;
+    }
+
+    c = reader->data[reader->index];
+    switch (c) {
+        case '"':
+            return json_read_string(reader, token);
+        case '{':
+        case '[':
+            return json_read_nested(reader, token);
+        case 't':
+            return json_read_literal(reader, token, "true", JSON_TRUE);
+        case 'f':
+            return json_read_literal(reader, token, "false", JSON_FALSE);
+        case 'n':
+            return json_read_literal(reader, token, "null", JSON_NULL);
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                return json_read_number(reader, token);
+            }
+            return 2;
+    }
+}
+
+int json_reader_enter(json_reader_t *reader, json_type_t type) {
+    json_skip_whitespace(reader);
+    if (reader->index >= reader->size ||
+            reader->data[reader->index] != (type == JSON_OBJECT ? '{' : '[')) {
+        return 2;
+    }
+
+    reader->index++;
+    return 0;
+}
+
+// Move past the separator before the next item, 1 if the container ends here
+static int json_reader_next_item(json_reader_t *reader, char end) {
+    json_skip_whitespace(reader);
+    if (reader->index >= reader->size) {
+        return 2;
+    }
+
+    if (reader->data[reader->index] == end) {
+        reader->index++;
+        return 1;
+    }
+    if (reader->data[reader->index] == ',') {
+        reader->index++;
+    }
+
+    return 0;
+}
+
+int json_reader_next_member(json_reader_t *reader, json_token_t *key, json_token_t *value) {
+    int result;
+
+    result = json_reader_next_item(reader, '}');
+    if (result) {
+        return result;
+    }
+
+    json_skip_whitespace(reader);
+    if (reader->index >= reader->size || reader->data[reader->index] != '"' ||
+            json_read_string(reader, key)) {
+        return 2;
+    }
+
+    json_skip_whitespace(reader);
+    if (reader->index >= reader->size || reader->data[reader->index] != ':') {
+        return 2;
+    }
+    reader->index++;
+
+    return json_read_value(reader, value);
+}
+
+int json_reader_next_element(json_reader_t *reader, json_token_t *value) {
+    int result;
+
+    result = json_reader_next_item(reader, ']');
+    if (result) {
+        return result;
+    }
+
+    return json_read_value(reader, value);
+}
+
+bool json_token_equals(const json_token_t *token, const char *str) {
+    size_t size = strlen(str);
+
+    return token->type == JSON_STRING && token->size == size &&
+        memcmp(token->start, str, size) == 0;
+}
+
+int json_token_to_int(const json_token_t *token, int32_t *value) {
+    const char *c = token->start, *end = token->start + token->size;
+    bool negative = false;
+    int64_t result = 0;
+
+    if (token->type != JSON_NUMBER) {
+        return 1;
+    }
+
+    if (c < end && *c == '-') {
+        negative = true;
+        c++;
+    }
+
+    // Stop at the fractional part or exponent, like cJSON's valueint
+    for (; c < end && *c >= '0' && *c <= '9'; c++) {
+        if (result <= INT32_MAX) {
+            result = result * 10 + (*c - '0');
+        }
+    }
+
+    if (negative) {
+        result = -result;
+    }
+    if (result > INT32_MAX) {
+        result = INT32_MAX;
+    } else if (result < INT32_MIN) {
+        result = INT32_MIN;
+    }
+
+    *value = (int32_t) result;
+    return 0;
+}
+
+static int json_hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Decode the 4 hex digits of a \u escape, -1 if malformed
+static int32_t json_read_hex4(const char *c, const char *end) {
+    int32_t value = 0;
+    int digit, i;
+
+    if (end - c < 4) {
+        return -1;
+    }
+
+    for (i = 0; i < 4; i++) {
+        digit = json_hex_digit(c[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        value = value << 4 | digit;
+    }
+
+    return value;
+}
+
+static size_t json_encode_utf8(uint32_t code, char *out) {
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = 0xc0 | code >> 6;
+        out[1] = 0x80 | (code & 0x3f);
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = 0xe0 | code >> 12;
+        out[1] = 0x80 | (code >> 6 & 0x3f);
+        out[2] = 0x80 | (code & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | code >> 18;
+    out[1] = 0x80 | (code >> 12 & 0x3f);
+    out[2] = 0x80 | (code >> 6 & 0x3f);
+    out[3] = 0x80 | (code & 0x3f);
+    return 4;
+}
+
+int json_token_unescape(const json_token_t *token, char *out, size_t size, size_t *length) {
+    const char *c = token->start, *end = token->start + token->size;
+    size_t count = 0, sequence;
+    int32_t code, low;
+    char bytes[4];
+
+    while (c < end) {
+        if (*c != '\\') {
+            // Copy whole UTF-8 sequences only
+            sequence = 1;
+            if ((*c & 0xe0) == 0xc0) {
+                sequence = 2;
+            } else if ((*c & 0xf0) == 0xe0) {
+                sequence = 3;
+            } else if ((*c & 0xf8) == 0xf0) {
+                sequence = 4;
+            }
+            if (sequence > (size_t) (end - c)) {
+                sequence = end - c;
+            }
+            memcpy(bytes, c, sequence);
+            c += sequence;
+        } else {
+            if (end - c < 2) {
+                break;
+            }
+            c++;
+            sequence = 1;
+            switch (*c++) {
+                case 'b': bytes[0] = '\b'; break;
+                case 'f': bytes[0] = '\f'; break;
+                case 'n': bytes[0] = '\n'; break;
+                case 'r': bytes[0] = '\r'; break;
+                case 't': bytes[0] = '\t'; break;
+                case 'u':
+                    code = json_read_hex4(c, end);
+                    if (code < 0) {
+                        code = '?';
+                    } else {
+                        c += 4;
+                    }
+                    // Combine UTF-16 surrogate pairs
+                    if (code >= 0xd800 && code < 0xdc00 && end - c >= 6 &&
+                            c[0] == '\\' && c[1] == 'u') {
+                        low = json_read_hex4(c + 2, end);
+                        if (low >= 0xdc00 && low < 0xe000) {
+                            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                            c += 6;
+                        }
+                    }
+                    sequence = json_encode_utf8(code, bytes);
+                    break;
+                default:
+                    // \", \\ and \/ stand for themselves
+                    bytes[0] = c[-1];
+                    break;
+            }
+        }
+
+        if (count + sequence >= size) {
+            out[count] = '\0';
+            *length = count;
+            return 1;
+        }
+        memcpy(out + count, bytes, sequence);
+        count += sequence;
+    }
+
+    out[count] = '\0';
+    *length = count;
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "message_builder.h"
+
+int message_builder_begin(message_builder_t *builder, char *data, size_t size, uint16_t type, uint16_t refersTo) {
+    buffer_write_init(&(builder->buffer), data, size);
+    builder->type = type;
+    builder->refersTo = refersTo;
+
+    return buffer_write_reserve(&(builder->buffer), BASE_MESSAGE_SIZE) == NULL;
+}
+
+int message_builder_finish(message_builder_t *builder, uint16_t id, tv_t sent, size_t *length) {
+    write_buffer_t header;
+    base_message_t base = {
+        builder->type,
+        id,
+        builder->refersTo,
+        sent,
+        { 0, 0 },
+        builder->buffer.index - BASE_MESSAGE_SIZE,
+    };
+
+    buffer_write_init(&header, builder->buffer.buffer, BASE_MESSAGE_SIZE);
+    if (base_message_encode(&base, &header)) {
+        return 1;
+    }
+
+    *length = builder->buffer.index;
+    return 0;
+}
@@ -1,210 +1,178 @@
 #include "snapcast.h"
 
-//#ifdef ESP_PLATFORM
-// The ESP-IDF changes the include directory for cJSON
-#include <cJSON.h>
-//#else
-//#include "json/cJSON.h"
-//#endif
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
 #include <buffer.h>
 
-const int BASE_MESSAGE_SIZE = 26;
-const int TIME_MESSAGE_SIZE = 8;
+#include "json_reader.h"
+
+MESSAGE_SCHEMA_DEFINE(base_message, base_message_t, BASE_MESSAGE_FIELDS)
+MESSAGE_SCHEMA_DEFINE(wire_chunk_header, wire_chunk_message_t, WIRE_CHUNK_HEADER_FIELDS)
+MESSAGE_SCHEMA_DEFINE(time_message, time_message_t, TIME_MESSAGE_FIELDS)
 
 int base_message_serialize(base_message_t *msg, char *data, uint32_t size) {
     write_buffer_t buffer;
-    int result = 0;
 
     buffer_write_init(&buffer, data, size);
-
-    result |= buffer_write_uint16(&buffer, msg->type);
-    result |= buffer_write_uint16(&buffer, msg->id);
-    result |= buffer_write_uint16(&buffer, msg->refersTo);
-    result |= buffer_write_int32(&buffer, msg->sent.sec);
-    result |= buffer_write_int32(&buffer, msg->sent.usec);
-    result |= buffer_write_int32(&buffer, msg->received.sec);
-    result |= buffer_write_int32(&buffer, msg->received.usec);
-    result |= buffer_write_uint32(&buffer, msg->size);
-
-    return result;
+    return base_message_encode(msg, &buffer);
 }
 
 int base_message_deserialize(base_message_t *msg, const char *data, uint32_t size) {
     read_buffer_t buffer;
-    int result = 0;
 
     buffer_read_init(&buffer, data, size);
-
-    result |= buffer_read_uint16(&buffer, &(msg->type));
-    result |= buffer_read_uint16(&buffer, &(msg->id));
-    result |= buffer_read_uint16(&buffer, &(msg->refersTo));
-    result |= buffer_read_int32(&buffer, &(msg->sent.sec));
-    result |= buffer_read_int32(&buffer, &(msg->sent.usec));
-    result |= buffer_read_int32(&buffer, &(msg->received.sec));
-    result |= buffer_read_int32(&buffer, &(msg->received.usec));
-    result |= buffer_read_uint32(&buffer, &(msg->size));
-
-    return result;
+    return base_message_decode(msg, &buffer);
 }
 
-static cJSON* hello_message_to_json(hello_message_t *msg) {
-    cJSON *mac;
-    cJSON *hostname;
-    cJSON *version;
-    cJSON *client_name;
-    cJSON *os;
-    cJSON *arch;
-    cJSON *instance;
-    cJSON *id;
-    cJSON *protocol_version;
-    cJSON *json = NULL;
-
-    json = cJSON_CreateObject();
-    if (!json) {
-        goto error;
-    }
-
-    mac = cJSON_CreateString(msg->mac);
-    if (!mac) {
-        goto error;
-    }
-    cJSON_AddItemToObject(json, "MAC", mac);
+static int json_write_raw(write_buffer_t *buffer, const char *str) {
+    return buffer_write_buffer(buffer, str, strlen(str));
+}
 
-    hostname = cJSON_CreateString(msg->hostname);
-    if (!hostname) {
-        goto error;
+static int json_write_string(write_buffer_t *buffer, const char *str) {
+    static const char hex[] = "0123456789abcdef";
+    const char *start = str;
+    int result = 0;
+    char escape[6];
+    unsigned char c;
+
+    result |= buffer_write_uint8(buffer, '"');
+    // Copy runs of plain characters in one go, only escapes are written
+    // separately
+    for (; (c = *str) != '\0'; str++) {
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        result |= buffer_write_buffer(buffer, start, str - start);
+        start = str + 1;
+
+        escape[0] = '\\';
+        if (c == '"' || c == '\\') {
+            escape[1] = c;
+            result |= buffer_write_buffer(buffer, escape, 2);
+        } else {
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 0xf];
+            result |= buffer_write_buffer(buffer, escape, 6);
+        }
     }
-    cJSON_AddItemToObject(json, "HostName", hostname);
+    result |= buffer_write_buffer(buffer, start, str - start);
+    result |= buffer_write_uint8(buffer, '"');
 
-    version = cJSON_CreateString(msg->version);
-    if (!version) {
-        goto error;
-    }
-    cJSON_AddItemToObject(json, "Version", version);
+    return result;
+}
 
-    client_name = cJSON_CreateString(msg->client_name);
-    if (!client_name) {
-        goto error;
-    }
-    cJSON_AddItemToObject(json, "ClientName", client_name);
+static int json_write_int(write_buffer_t *buffer, int value) {
+    char digits[11];
+    int count = 0;
+    uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+    int result = 0;
 
-    os = cJSON_CreateString(msg->os);
-    if (!os) {
-        goto error;
-    }
-    cJSON_AddItemToObject(json, "OS", os);
+    do {
+        digits[sizeof(digits) - ++count] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
 
-    arch = cJSON_CreateString(msg->arch);
-    if (!arch) {
-        goto error;
+    if (value < 0) {
+        result |= buffer_write_uint8(buffer, '-');
     }
-    cJSON_AddItemToObject(json, "Arch", arch);
+    result |= buffer_write_buffer(buffer, digits + sizeof(digits) - count, count);
 
-    instance = cJSON_CreateNumber(msg->instance);
-    if (!instance) {
-        goto error;
-    }
-    cJSON_AddItemToObject(json, "Instance", instance);
+    return result;
+}
 
-    id = cJSON_CreateString(msg->id);
-    if (!id) {
-        goto error;
-    }
-    cJSON_AddItemToObject(json, "ID", id);
+int hello_message_serialize(hello_message_t *msg, write_buffer_t *buffer) {
+    char *prefix;
+    size_t start;
+    int result = 0;
 
-    protocol_version = cJSON_CreateNumber(msg->protocol_version);
-    if (!protocol_version) {
-        goto error;
+    // The JSON string is prefixed with its length, which is only known at the end
+    prefix = buffer_write_reserve(buffer, sizeof(uint32_t));
+    if (!prefix) {
+        return 1;
     }
-    cJSON_AddItemToObject(json, "SnapStreamProtocolVersion", protocol_version);
-
-    goto end;
-error:
-    cJSON_Delete(json);
+    start = buffer->index;
+
+    result |= json_write_raw(buffer, "{\"MAC\":");
+    result |= json_write_string(buffer, msg->mac);
+    result |= json_write_raw(buffer, ",\"HostName\":");
+    result |= json_write_string(buffer, msg->hostname);
+    result |= json_write_raw(buffer, ",\"Version\":");
+    result |= json_write_string(buffer, msg->version);
+    result |= json_write_raw(buffer, ",\"ClientName\":");
+    result |= json_write_string(buffer, msg->client_name);
+    result |= json_write_raw(buffer, ",\"OS\":");
+    result |= json_write_string(buffer, msg->os);
+    result |= json_write_raw(buffer, ",\"Arch\":");
+    result |= json_write_string(buffer, msg->arch);
+    result |= json_write_raw(buffer, ",\"Instance\":");
+    result |= json_write_int(buffer, msg->instance);
+    result |= json_write_raw(buffer, ",\"ID\":");
+    result |= json_write_string(buffer, msg->id);
+    result |= json_write_raw(buffer, ",\"SnapStreamProtocolVersion\":");
+    result |= json_write_int(buffer, msg->protocol_version);
+    result |= json_write_raw(buffer, "}");
 
-end:
-    return json;
-}
-
-char* hello_message_serialize(hello_message_t* msg, size_t *size) {
-    int str_length, prefixed_length;
-    cJSON *json;
-    char *str = NULL;
-	char *prefixed_str = NULL;
-
-    json = hello_message_to_json(msg);
-    if (!json) {
-        return NULL;
+    if (result) {
+        return result;
     }
 
-    str = cJSON_PrintUnformatted(json);
-	if (!str) {
-		return NULL;
-	}
-    cJSON_Delete(json);
-
-	str_length = strlen(str);
-	prefixed_length = str_length + 4;
-	prefixed_str = malloc(prefixed_length);
-	if (!prefixed_str) {
-		return NULL;
-	}
-
-	prefixed_str[0] = str_length & 0xff;
-	prefixed_str[1] = (str_length >> 8) & 0xff;
-	prefixed_str[2] = (str_length >> 16) & 0xff;
-	prefixed_str[3] = (str_length >> 24) & 0xff;
-	memcpy(&(prefixed_str[4]), str, str_length);
-	free(str);
-	*size = prefixed_length;
-
-    return prefixed_str;
+    buffer_store_uint32(prefix, buffer->index - start);
+    return 0;
 }
 
-int server_settings_message_deserialize(server_settings_message_t *msg, const char *json_str) {
-    int status = 1;
-    cJSON *value = NULL;
-    cJSON *json = cJSON_Parse(json_str);
-    if (!json) {
-        const char *error_ptr = cJSON_GetErrorPtr();
-        if (error_ptr) {
-            // TODO change to a macro that can be diabled
-            fprintf(stderr, "Error before: %s\n", error_ptr);
-            goto end;
-        }
-    }
+int server_settings_message_deserialize(server_settings_message_t *msg, const char *data, uint32_t size) {
+    read_buffer_t buffer;
+    json_reader_t reader;
+    json_token_t key, value;
+    uint32_t json_size;
+    const char *json;
+    int32_t number;
+    int result;
 
     if (msg == NULL) {
-        status = 2;
-        goto end;
+        return 2;
     }
 
-    value = cJSON_GetObjectItemCaseSensitive(json, "bufferMs");
-    if (cJSON_IsNumber(value)) {
-        msg->buffer_ms = value->valueint;
+    // The JSON string is prefixed with its length, parse it where it lies
+    buffer_read_init(&buffer, data, size);
+    if (buffer_read_uint32(&buffer, &json_size)) {
+        return 1;
+    }
+    json = buffer_read_reserve(&buffer, json_size);
+    if (!json) {
+        return 1;
     }
 
-    value = cJSON_GetObjectItemCaseSensitive(json, "latency");
-    if (cJSON_IsNumber(value)) {
-        msg->latency = value->valueint;
+    json_reader_init(&reader, json, json_size);
+    if (json_reader_enter(&reader, JSON_OBJECT)) {
+        return 1;
     }
 
-    value = cJSON_GetObjectItemCaseSensitive(json, "volume");
-    if (cJSON_IsNumber(value)) {
-        msg->volume = value->valueint;
+    msg->muted = false;
+    while ((result = json_reader_next_member(&reader, &key, &value)) == 0) {
+        if (json_token_equals(&key, "bufferMs")) {
+            if (!json_token_to_int(&value, &number)) {
+                msg->buffer_ms = number;
+            }
+        } else if (json_token_equals(&key, "latency")) {
+            if (!json_token_to_int(&value, &number)) {
+                msg->latency = number;
+            }
+        } else if (json_token_equals(&key, "volume")) {
+            if (!json_token_to_int(&value, &number)) {
+                msg->volume = number;
+            }
+        } else if (json_token_equals(&key, "muted")) {
+            msg->muted = value.type == JSON_TRUE;
+        }
     }
 
-    value = cJSON_GetObjectItemCaseSensitive(json, "muted");
-    msg->muted = cJSON_IsTrue(value);
-    status = 0;
-end:
-    cJSON_Delete(json);
-    return status;
+    return result == 1 ? 0 : 1;
 }
 
 int codec_header_message_deserialize(codec_header_message_t *msg, const char *data, uint32_t size) {
@@ -246,32 +214,34 @@ int codec_header_message_deserialize(codec_header_message_t *msg, const char *da
 
 int wire_chunk_message_deserialize(wire_chunk_message_t *msg, const char *data, uint32_t size) {
     read_buffer_t buffer;
-    int result = 0;
 
     buffer_read_init(&buffer, data, size);
 
-    result |= buffer_read_int32(&buffer, &(msg->timestamp.sec));
-    result |= buffer_read_int32(&buffer, &(msg->timestamp.usec));
-    result |= buffer_read_uint32(&buffer, &(msg->size));
-
-    // If there's been an error already (especially for the size bit) return early
-    if (result) {
-        return result;
+    if (wire_chunk_header_decode(msg, &buffer)) {
+        return 1;
     }
 
-	msg->payload = &(buffer.buffer[buffer.index]);
-	return result;
-	/*
-    // TODO maybe should check to see if need to free memory?
-    msg->payload = malloc(msg->size * sizeof(char));
-    // Failed to allocate the memory
+    msg->payload = buffer_read_reserve(&buffer, msg->size);
     if (!msg->payload) {
+        return 1;
+    }
+
+    msg->chunk = NULL;
+    return 0;
+}
+
+int wire_chunk_message_own(wire_chunk_message_t *msg) {
+    if (msg->chunk) {
+        return 0;
+    }
+
+    msg->chunk = chunk_buffer_copy(msg->payload, msg->size);
+    if (!msg->chunk) {
         return 2;
     }
 
-    result |= buffer_read_buffer(&buffer, msg->payload, msg->size);
-    return result;
-	*/
+    msg->payload = msg->chunk->data;
+    return 0;
 }
 
 void codec_header_message_free(codec_header_message_t *msg) {
@@ -282,32 +252,205 @@ void codec_header_message_free(codec_header_message_t *msg) {
 }
 
 void wire_chunk_message_free(wire_chunk_message_t *msg) {
-    if (msg->payload) {
-        free(msg->payload);
-        msg->payload = NULL;
+    if (msg->chunk) {
+        chunk_buffer_free(msg->chunk);
+        msg->chunk = NULL;
+    }
+    msg->payload = NULL;
+}
+
+chunk_buffer_t *chunk_buffer_copy(const char *data, uint32_t size) {
+    // The data lives right after the chunk header, in the same allocation
+    chunk_buffer_t *chunk = malloc(sizeof(chunk_buffer_t) + size);
+    if (!chunk) {
+        return NULL;
     }
+
+    memcpy(chunk + 1, data, size);
+    chunk->data = (const char *) (chunk + 1);
+    chunk->size = size;
+    return chunk;
+}
+
+void chunk_buffer_free(chunk_buffer_t *chunk) {
+    free(chunk);
 }
 
 int time_message_serialize(time_message_t *msg, char *data, uint32_t size) {
     write_buffer_t buffer;
-    int result = 0;
 
     buffer_write_init(&buffer, data, size);
+    return time_message_encode(msg, &buffer);
+}
 
-    result |= buffer_write_int32(&buffer, msg->latency.sec);
-    result |= buffer_write_int32(&buffer, msg->latency.usec);
+int time_message_deserialize(time_message_t *msg, const char *data, uint32_t size) {
+    read_buffer_t buffer;
 
-    return result;
+    buffer_read_init(&buffer, data, size);
+    return time_message_decode(msg, &buffer);
 }
 
-int time_message_deserialize(time_message_t *msg, const char *data, uint32_t size) {
+// 32 bits FNV-1a
+static uint32_t stream_tags_hash(const char *data, uint32_t size) {
+    uint32_t hash = 2166136261u;
+    uint32_t i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+void stream_tags_message_init(stream_tags_message_t *msg) {
+    msg->arena[0] = '\0';
+    msg->title = msg->arena;
+    msg->artist = msg->arena;
+    msg->album = msg->arena;
+    msg->art_url = msg->arena;
+    msg->truncated = false;
+    msg->hash = 0;
+    msg->payload_size = 0;
+}
+
+bool stream_tags_message_changed(stream_tags_message_t *msg, const char *data, uint32_t size) {
+    return size != msg->payload_size || stream_tags_hash(data, size) != msg->hash;
+}
+
+/*
+ * Copy a string or array of strings value to the arena, NULL for other
+ * values. Unless "partial", a value that does not fit whole is left out and
+ * the field is "".
+ */
+static const char *stream_tags_store(stream_tags_message_t *msg, size_t *used, const json_token_t *value,
+                                     bool partial) {
+    bool truncated = false;
+    char *out = msg->arena + *used;
+    size_t room = sizeof(msg->arena) - *used;
+    size_t size = 0, length;
+    json_reader_t reader;
+    json_token_t element;
+
+    if (value->type != JSON_STRING && value->type != JSON_ARRAY) {
+        return NULL;
+    }
+
+    if (room > STREAM_TAGS_FIELD_MAX) {
+        room = STREAM_TAGS_FIELD_MAX;
+    }
+    if (room == 0) {
+        // The arena is full, fall back to the shared empty string
+        msg->truncated = true;
+        return msg->arena;
+    }
+
+    if (value->type == JSON_STRING) {
+        truncated = json_token_unescape(value, out, room, &size);
+    } else {
+        out[0] = '\0';
+        json_reader_init(&reader, value->start, value->size);
+        json_reader_enter(&reader, JSON_ARRAY);
+        while (json_reader_next_element(&reader, &element) == 0) {
+            if (element.type != JSON_STRING) {
+                continue;
+            }
+            if (size) {
+                // the separator, a character and the terminator
+                if (size + 3 >= room) {
+                    truncated = true;
+                    break;
+                }
+                memcpy(out + size, ", ", 3);
+                size += 2;
+            }
+            if (json_token_unescape(&element, out + size, room - size, &length)) {
+                truncated = true;
+            }
+            size += length;
+        }
+    }
+
+    if (truncated) {
+        msg->truncated = true;
+        if (!partial) {
+            return msg->arena;
+        }
+    }
+    *used += size + 1;
+    return out;
+}
+
+static const char *stream_tags_rebase(const stream_tags_message_t *dst, const stream_tags_message_t *src,
+                                      const char *field) {
+    return dst->arena + (field - src->arena);
+}
+
+void stream_tags_message_copy(stream_tags_message_t *dst, const stream_tags_message_t *src) {
+    memcpy(dst, src, sizeof(*dst));
+    dst->title = stream_tags_rebase(dst, src, src->title);
+    dst->artist = stream_tags_rebase(dst, src, src->artist);
+    dst->album = stream_tags_rebase(dst, src, src->album);
+    dst->art_url = stream_tags_rebase(dst, src, src->art_url);
+}
+
+int stream_tags_message_deserialize(stream_tags_message_t *msg, stream_tags_message_t *scratch,
+                                    const char *data, uint32_t size) {
+    stream_tags_message_t *tags = scratch;
     read_buffer_t buffer;
-    int result = 0;
+    json_reader_t reader;
+    json_token_t key, value;
+    const char **field;
+    const char *json;
+    uint32_t json_size;
+    size_t used = 1;    // arena[0] is the shared empty string
+    int result;
+
+    stream_tags_message_init(tags);
 
     buffer_read_init(&buffer, data, size);
+    if (buffer_read_uint32(&buffer, &json_size)) {
+        return 1;
+    }
+    json = buffer_read_reserve(&buffer, json_size);
+    if (!json) {
+        return 1;
+    }
 
-    result |= buffer_read_int32(&buffer, &(msg->latency.sec));
-    result |= buffer_read_int32(&buffer, &(msg->latency.usec));
+    json_reader_init(&reader, json, json_size);
+    if (json_reader_enter(&reader, JSON_OBJECT)) {
+        return 1;
+    }
 
-    return result;
+    // Plain snapcast tags as well as their MPRIS names are recognized
+    while ((result = json_reader_next_member(&reader, &key, &value)) == 0) {
+        if (json_token_equals(&key, "title") || json_token_equals(&key, "xesam:title")) {
+            field = &(tags->title);
+        } else if (json_token_equals(&key, "artist") || json_token_equals(&key, "xesam:artist")) {
+            field = &(tags->artist);
+        } else if (json_token_equals(&key, "album") || json_token_equals(&key, "xesam:album")) {
+            field = &(tags->album);
+        } else if (json_token_equals(&key, "artUrl") || json_token_equals(&key, "mpris:artUrl")) {
+            field = &(tags->art_url);
+        } else {
+            continue;
+        }
+
+        // Keep the first occurrence of each field
+        if (*field == tags->arena) {
+            json = stream_tags_store(tags, &used, &value, field != &(tags->art_url));
+            if (json) {
+                *field = json;
+            }
+        }
+    }
+
+    if (result != 1) {
+        return 1;
+    }
+
+    tags->hash = stream_tags_hash(data, size);
+    tags->payload_size = size;
+    stream_tags_message_copy(msg, tags);
+    return 0;
 }
@@ -0,0 +1,210 @@
+#ifndef _JITTER_BUFFER_H_
+#define _JITTER_BUFFER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "snapcast.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Wire chunks waiting for their play time.
+ *
+ * Chunks are kept in server timestamp order, each owning a copy of its
+ * payload, and are released once the server clock reaches their timestamp
+ * plus the play out delay (bufferMs - latency from the server settings).
+ * Both the number of chunks and the bytes held are bounded; when either is
+ * reached the oldest chunk is dropped.
+ *
+ * Plain C, all times are server microseconds.
+ */
+
+typedef struct jitter_buffer_entry {
+    int64_t timestamp_us;       /*!< Server time of the first sample */
+    wire_chunk_message_t chunk; /*!< Owned chunk */
+} jitter_buffer_entry_t;
+
+typedef struct jitter_buffer_stats {
+    uint32_t pushed;
+    uint32_t overflows;         /*!< Chunks dropped because the buffer was full */
+    uint32_t reordered;         /*!< Chunks dropped because they were older than the last one */
+} jitter_buffer_stats_t;
+
+/*
+ * How playback was lined up on the schedule by jitter_buffer_start().
+ */
+typedef struct jitter_buffer_start {
+    int64_t     play_us;        /*!< Server time the first output sample was scheduled for */
+    int64_t     error_ns;       /*!< When it is actually played compared to that, positive when late */
+    uint32_t    silence_frames; /*!< Frames of silence to output before the head chunk */
+    int64_t     wait_us;        /*!< Time to wait before outputting a compressed head chunk */
+    uint32_t    trimmed_frames; /*!< Leading frames cut from the head chunk */
+    uint32_t    dropped_chunks; /*!< Chunks dropped whole because they were already over */
+} jitter_buffer_start_t;
+
+typedef struct jitter_buffer {
+    jitter_buffer_entry_t *entries; /*!< Ring of chunks */
+    size_t      capacity;
+    size_t      head;
+    size_t      count;
+    size_t      bytes;          /*!< Payload bytes held */
+    size_t      max_bytes;
+    int64_t     delay_us;       /*!< Play out delay */
+    int64_t     last_us;        /*!< Timestamp of the last pushed chunk */
+    int64_t     chunk_us;       /*!< Timestamp step between the last chunks */
+    jitter_buffer_stats_t stats;
+} jitter_buffer_t;
+
+/**
+ * @brief      Allocate the chunk ring
+ *
+ * @param      jb         The jitter buffer
+ * @param      capacity   The maximum number of chunks
+ * @param      max_bytes  The maximum number of payload bytes held
+ *
+ * @return     0 on success, 2 if the allocation failed
+ */
+int jitter_buffer_init(jitter_buffer_t *jb, size_t capacity, size_t max_bytes);
+
+/**
+ * @brief      Change the bounds, keeping the buffered chunks
+ *
+ * The oldest chunks are dropped (and counted as overflows) if they do not
+ * fit the new bounds.
+ *
+ * @param      jb         The jitter buffer
+ * @param      capacity   The maximum number of chunks
+ * @param      max_bytes  The maximum number of payload bytes held
+ *
+ * @return     0 on success, 2 if the allocation failed and nothing changed
+ */
+int jitter_buffer_resize(jitter_buffer_t *jb, size_t capacity, size_t max_bytes);
+
+/**
+ * @brief      Drop all chunks and free the ring
+ */
+void jitter_buffer_deinit(jitter_buffer_t *jb);
+
+/**
+ * @brief      Drop all chunks, on stream change or reconnection
+ */
+void jitter_buffer_clear(jitter_buffer_t *jb);
+
+/**
+ * @brief      Set the play out delay
+ *
+ * @param      jb        The jitter buffer
+ * @param      delay_us  Time between the chunk timestamps and their play time
+ */
+void jitter_buffer_set_delay(jitter_buffer_t *jb, int64_t delay_us);
+
+/**
+ * @brief      Add a chunk, copying its payload unless it is already owned
+ *
+ * The message reference to its payload is moved to the buffer, the caller
+ * must not free it when this succeeds. The oldest chunks are dropped, and
+ * counted as overflows, to stay within the capacity and byte ceiling, and
+ * to free heap when the copy cannot be allocated.
+ *
+ * @param      jb     The jitter buffer
+ * @param      chunk  The received chunk
+ *
+ * @return     0 if the chunk was added, 1 if it was dropped (out of order),
+ *             2 if the payload copy could not be allocated even with the
+ *             buffer emptied
+ */
+int jitter_buffer_push(jitter_buffer_t *jb, wire_chunk_message_t *chunk);
+
+/**
+ * @brief      Oldest chunk, NULL if the buffer is empty
+ */
+jitter_buffer_entry_t *jitter_buffer_peek(jitter_buffer_t *jb);
+
+/**
+ * @brief      Drop the oldest chunk, once released or discarded
+ */
+void jitter_buffer_pop(jitter_buffer_t *jb);
+
+/**
+ * @brief      Play time of a chunk, in server time
+ */
+static inline int64_t jitter_buffer_play_time(const jitter_buffer_t *jb, const jitter_buffer_entry_t *entry)
+{
+    return entry->timestamp_us + jb->delay_us;
+}
+
+/**
+ * @brief      Oldest chunk if it is due at server time "now_us", NULL otherwise
+ */
+jitter_buffer_entry_t *jitter_buffer_due(jitter_buffer_t *jb, int64_t now_us);
+
+/**
+ * @brief      Duration of a chunk
+ *
+ * Exact for pcm; compressed chunks last until the next one starts, or as
+ * long as the previous ones did for the last chunk.
+ *
+ * @param      jb          The jitter buffer
+ * @param      entry       A buffered chunk
+ * @param      rate        The sample rate
+ * @param      frame_size  Bytes per PCM frame, 0 for compressed chunks
+ *
+ * @return     The duration in microseconds
+ */
+int64_t jitter_buffer_duration(const jitter_buffer_t *jb, const jitter_buffer_entry_t *entry,
+                               uint32_t rate, uint32_t frame_size);
+
+/**
+ * @brief      Drop the chunks that should have started before "deadline_us"
+ *
+ * Late chunks are dropped while still encoded, so no time is spent
+ * decoding audio that would only add delay.
+ *
+ * @param      jb          The jitter buffer
+ * @param      deadline_us Server play time before which chunks are dropped
+ * @param      rate        The sample rate
+ * @param      frame_size  Bytes per PCM frame, 0 for compressed chunks
+ * @param      dropped_us  Duration of the dropped chunks
+ *
+ * @return     The number of chunks dropped
+ */
+size_t jitter_buffer_drop_late(jitter_buffer_t *jb, int64_t deadline_us, uint32_t rate,
+                               uint32_t frame_size, int64_t *dropped_us);
+
+/**
+ * @brief      Line up the head chunk to start playback at server time "now_us"
+ *
+ * The time at which the next output byte will be played is "now_us". With
+ * the frame size of a PCM stream, the start is sample accurate: leading
+ * frames already over are trimmed from the head chunk, and a head chunk due
+ * within "lead_us" gets the number of silence frames to output first. The
+ * remaining error is then within half a sample period.
+ *
+ * Compressed chunks (frame_size 0) can neither be cut nor preceded by
+ * silence: a head chunk due within "lead_us" comes with the time to wait
+ * before outputting it instead, and overdue ones are dropped whole for the
+ * first chunk still to come. Waiting that long, the start is on schedule.
+ *
+ * @param      jb          The jitter buffer
+ * @param      now_us      Server time the next output byte plays at
+ * @param      lead_us     How early a head chunk may be started, with silence for
+ *                         PCM or a wait for compressed chunks
+ * @param      rate        The sample rate
+ * @param      frame_size  Bytes per PCM frame, 0 for compressed chunks
+ * @param      start       The alignment applied, valid when a chunk is returned
+ *
+ * @return     The head chunk to output, NULL if nothing is to be started yet
+ */
+jitter_buffer_entry_t *jitter_buffer_start(jitter_buffer_t *jb, int64_t now_us, int64_t lead_us,
+                                           uint32_t rate, uint32_t frame_size,
+                                           jitter_buffer_start_t *start);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Distribution of how late chunks arrive: the server time of their arrival
+ * minus their timestamp, ie. how long the server and the network held them.
+ * A chunk is on time if that stays below the play out delay, so the tail of
+ * the distribution gives the smallest delay a link can sustain.
+ *
+ * Counts are halved every LATENCY_HISTOGRAM_DECAY chunks, so the histogram
+ * follows changing link conditions over a few minutes.
+ *
+ * Plain C, times in microseconds.
+ */
+
+#define LATENCY_HISTOGRAM_BINS      400
+#define LATENCY_HISTOGRAM_BIN_US    5000    /*!< 2 s range, later chunks go to the last bin */
+#define LATENCY_HISTOGRAM_DECAY     3000    /*!< 1 minute of 20 ms chunks */
+
+typedef struct latency_histogram {
+    uint16_t    bins[LATENCY_HISTOGRAM_BINS];
+    uint32_t    count;      /*!< Weight of the bins */
+    uint32_t    added;      /*!< Chunks added since the last decay */
+    int64_t     max_us;     /*!< Latest chunk seen since the last decay */
+} latency_histogram_t;
+
+/**
+ * @brief      Init an empty histogram
+ */
+void latency_histogram_init(latency_histogram_t *histogram);
+
+/**
+ * @brief      Add a chunk arrival
+ *
+ * @param      histogram    The histogram
+ * @param      lateness_us  Server arrival time minus the chunk timestamp
+ */
+void latency_histogram_add(latency_histogram_t *histogram, int64_t lateness_us);
+
+/**
+ * @brief      Lateness below which a fraction of the chunks arrived
+ *
+ * @param      histogram  The histogram
+ * @param      fraction   The fraction, 0.999 for the 99.9th percentile
+ *
+ * @return     The upper edge of the bin holding the quantile
+ */
+int64_t latency_histogram_quantile(const latency_histogram_t *histogram, double fraction);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _PLAYBACK_POSITION_H_
+#define _PLAYBACK_POSITION_H_
+
+#include "audio_element.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Where playback stands behind the snapclient stream: the frames sitting in
+ * the ring buffers between the downstream elements, in the I2S DMA buffers
+ * and in the codec, which all play before anything output now.
+ *
+ * The I2S driver keeps its DMA buffers full while playing (it repeats or
+ * zeroes them on underrun), so they always add their whole size. Ring
+ * buffers only count once the data is pcm: register the elements after the
+ * decoder, if any.
+ */
+
+#define PLAYBACK_POSITION_MAX_ELEMENTS  4
+#define PLAYBACK_POSITION_DMA_BUF_MIN   2       /*!< I2S driver limits */
+#define PLAYBACK_POSITION_DMA_BUF_MAX   128
+#define PLAYBACK_POSITION_DMA_LEN_MAX   1024    /*!< Frames per DMA buffer */
+#define PLAYBACK_POSITION_DMA_BYTES_MAX 4092    /*!< Bytes per DMA buffer */
+
+typedef struct playback_position {
+    audio_element_handle_t  elements[PLAYBACK_POSITION_MAX_ELEMENTS]; /*!< Elements whose input ring buffer holds pcm */
+    int                     count;
+    audio_element_handle_t  sink;           /*!< Element giving the sample format, the I2S writer */
+    uint32_t                dma_frames;     /*!< Frames held by the I2S DMA buffers */
+    uint32_t                codec_frames;   /*!< Group delay of the codec */
+} playback_position_t;
+
+/**
+ * @brief      Init the position of an I2S output
+ *
+ * @param      position       The playback position
+ * @param      sink           The I2S writer element
+ * @param      dma_buf_count  The I2S DMA buffer count
+ * @param      dma_buf_len    The I2S DMA buffer length, in frames
+ */
+void playback_position_init(playback_position_t *position, audio_element_handle_t sink,
+                            int dma_buf_count, int dma_buf_len);
+
+/**
+ * @brief      Follow a new I2S DMA configuration, after the driver was
+ *             installed again for another sample format
+ *
+ * @param      position       The playback position
+ * @param      dma_buf_count  The I2S DMA buffer count
+ * @param      dma_buf_len    The I2S DMA buffer length, in frames
+ */
+void playback_position_set_dma(playback_position_t *position, int dma_buf_count, int dma_buf_len);
+
+/**
+ * @brief      Add the next element downstream, its input ring buffer is counted
+ *
+ * @return     ESP_OK, ESP_FAIL if PLAYBACK_POSITION_MAX_ELEMENTS are already added
+ */
+esp_err_t playback_position_add(playback_position_t *position, audio_element_handle_t el);
+
+/**
+ * @brief      Frames queued downstream, a snapclient_stream_downstream_cb
+ *
+ * @param      ctx   The playback position
+ *
+ * @return     The number of frames to play before the next output one
+ */
+uint32_t playback_position_frames(void *ctx);
+
+/**
+ * @brief      Frames always queued downstream, whether audio comes or not:
+ *             the DMA buffers and the codec
+ *
+ * @param      position  The playback position
+ *
+ * @return     The number of frames
+ */
+uint32_t playback_position_fixed_frames(const playback_position_t *position);
+
+/**
+ * @brief      I2S DMA buffers holding about "latency_ms" of audio
+ *
+ * Buffers are made as large as the driver allows, to keep interrupts rare,
+ * and their count then follows from the latency.
+ *
+ * @param      rate           The sample rate
+ * @param      frame_size     Bytes per frame
+ * @param      latency_ms     The latency target
+ * @param      dma_buf_count  The DMA buffer count to configure
+ * @param      dma_buf_len    The DMA buffer length to configure, in frames
+ */
+void playback_position_dma_config(int rate, int frame_size, int latency_ms,
+                                  int *dma_buf_count, int *dma_buf_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
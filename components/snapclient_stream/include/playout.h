@@ -0,0 +1,67 @@
+#ifndef _PLAYOUT_H_
+#define _PLAYOUT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * How much fresh audio is queued after the snapclient stream.
+ *
+ * The downstream latency has two parts: the ring buffers between the
+ * elements, which drain when the stream stops writing, and a fixed part,
+ * the I2S DMA buffers and the codec, which never does (the driver replays
+ * or zeroes its buffers on underrun). Only the ring buffers tell how long
+ * the stream may stay silent before the DAC runs out of audio.
+ *
+ * Plain C, all times are server microseconds.
+ */
+
+typedef struct playout_level {
+    int64_t now_us;         /*!< Server time now */
+    int64_t play_now_us;    /*!< Server time the next output frame plays at, now plus the downstream latency */
+    int64_t fixed_us;       /*!< Part of the downstream latency that never drains */
+} playout_level_t;
+
+/**
+ * @brief      Audio queued downstream that drains, the fixed part left out
+ *
+ * @return     The duration, 0 when the ring buffers are empty
+ */
+int64_t playout_buffered_us(const playout_level_t *level);
+
+/**
+ * @brief      Silence keeping "fill_us" queued downstream during a gap
+ *
+ * @param      level    The downstream level
+ * @param      fill_us  The audio to keep queued
+ * @param      rate     The sample rate
+ *
+ * @return     The frames to output, 0 if enough is queued
+ */
+uint32_t playout_gap_frames(const playout_level_t *level, int64_t fill_us, uint32_t rate);
+
+/**
+ * @brief      How much longer the last buffered chunk may wait for the next
+ *             one to arrive
+ *
+ * Holding a due chunk does not delay it while audio is still queued
+ * downstream. It must go, faded out, while what is left covers its lead
+ * and the poll period that may pass before the next release.
+ *
+ * @param      level    The downstream level
+ * @param      lead_us  Time the chunk needs before the ring buffers run dry:
+ *                      its fade out, plus decoding for compressed chunks
+ * @param      poll_us  The longest wait between two releases
+ *
+ * @return     The time left, 0 if the chunk must be released now
+ */
+int64_t playout_hold_us(const playout_level_t *level, int64_t lead_us, int64_t poll_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
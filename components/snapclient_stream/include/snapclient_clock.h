@@ -0,0 +1,56 @@
+#ifndef _SNAPCLIENT_CLOCK_H_
+#define _SNAPCLIENT_CLOCK_H_
+
+#include <stdint.h>
+
+#include "snapcast.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Client time base for the sync code: monotonic microseconds since boot, as
+ * 64-bit integers. Unlike gettimeofday() it never jumps when the wall clock
+ * is set (SNTP), and it needs no conversion for arithmetic.
+ *
+ * The snapcast protocol carries timestamps as tv_t pairs; the server only
+ * subtracts them, so any time base works as long as it is used consistently.
+ */
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+
+static inline int64_t snapclient_clock_now_us(void)
+{
+    return esp_timer_get_time();
+}
+#else
+#include <time.h>
+
+static inline int64_t snapclient_clock_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+static inline int64_t tv_to_us(tv_t tv)
+{
+    return (int64_t) tv.sec * 1000000 + tv.usec;
+}
+
+static inline tv_t tv_from_us(int64_t us)
+{
+    tv_t tv = { (int32_t) (us / 1000000), (int32_t) (us % 1000000) };
+
+    return tv;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,6 +13,9 @@ extern "C" {
 typedef enum {
     SNAPCLIENT_STREAM_STATE_NONE,
     SNAPCLIENT_STREAM_STATE_CONNECTED,
+    SNAPCLIENT_STREAM_STATE_TAGS,           /*!< Stream tags changed, data is a stream_tags_message_t */
+    SNAPCLIENT_STREAM_STATE_STARTED,        /*!< Playback lined up on the schedule, data is a jitter_buffer_start_t */
+    SNAPCLIENT_STREAM_STATE_LATENCY,        /*!< New play out delay recommendation, data is a snapclient_stream_latency_t */
 } snapclient_stream_status_t;
 
 /**
@@ -28,6 +31,41 @@ typedef struct snapclient_stream_event_msg {
 
 typedef esp_err_t (*snapclient_stream_event_handle_cb)(snapclient_stream_event_msg_t *msg, snapclient_stream_status_t state, void *event_ctx);
 
+/**
+ * @brief   Number of frames output by the stream but not played by the DAC
+ *          yet, see playback_position.h
+ */
+typedef uint32_t (*snapclient_stream_downstream_cb)(void *ctx);
+
+/**
+ * @brief   Playback statistics of the stream
+ */
+typedef struct snapclient_stream_stats {
+    uint32_t                      gaps;             /*!< Times the stream ran dry and rejoined */
+    uint32_t                      gap_ms;           /*!< Total audio missed in those gaps */
+    uint32_t                      late_chunks;      /*!< Chunks dropped because they were past their play time */
+    uint32_t                      late_ms;          /*!< Total audio in those chunks */
+    uint32_t                      overflows;        /*!< Chunks dropped because the jitter buffer was full */
+    uint32_t                      decode_ahead_ms;  /*!< How early compressed chunks are released to the decoder */
+    uint32_t                      decode_pending_ms; /*!< Most released audio seen waiting for the decoder */
+} snapclient_stream_stats_t;
+
+/**
+ * @brief   Play out delay recommended from the measured chunk lateness
+ *
+ * The server can apply it to this client by setting its latency to
+ * latency_ms, the client then plays in sync with the others as long as its
+ * link keeps up.
+ */
+typedef struct snapclient_stream_latency {
+    int32_t                       buffer_ms;        /*!< Smallest safe delay between chunk timestamps and play out */
+    int32_t                       latency_ms;       /*!< Client latency giving that delay with the server bufferMs */
+    int32_t                       lateness_ms;      /*!< Chunk lateness percentile the recommendation covers */
+    int32_t                       max_ms;           /*!< Latest chunk seen recently */
+    uint32_t                      chunks;           /*!< Weight of the lateness histogram */
+    bool                          applied;          /*!< Whether the stream now uses buffer_ms */
+} snapclient_stream_latency_t;
+
 /**
  * @brief Stream configuration, if any entry is zero then the configuration
  * will be set to default values
@@ -36,6 +74,14 @@ typedef struct {
     audio_stream_type_t         type;               /*!< Type of stream */
     int                         out_rb_size;            /*!< Size of output ringbuffer */
     int                         timeout_ms;         /*!< time timeout for read/write*/
+    int                         jitter_buffer_size; /*!< Memory ceiling for the chunks waiting for their play time,
+                                                         further limited by the free heap */
+    int                         late_tolerance_ms;  /*!< How late a chunk may start before it is dropped */
+    bool                        auto_latency;       /*!< Play with the recommended delay instead of the server one,
+                                                         out of sync with other clients by the difference */
+    bool                        decoder;            /*!< A decoder element follows the stream, without one
+                                                         compressed codecs are refused instead of played as pcm */
+    int                         decode_ahead_ms;    /*!< Bound on how early compressed chunks are released */
     int                         port;               /*!< TCP port> */
     char                        *host;              /*!< TCP host> */
     int                         task_stack;         /*!< Task stack size */
@@ -50,15 +96,42 @@ typedef struct {
 
 #define SNAPCLIENT_STREAM_TASK_STACK        (3072)
 #define SNAPCLIENT_STREAM_BUF_SIZE          (4096)
+#define SNAPCLIENT_STREAM_FRAME_BUF_SIZE    (8 * 1024)    /*!< Largest message handled, header included, larger ones are dropped */
+#define SNAPCLIENT_STREAM_WRITER_STACK      (3072)
+#define SNAPCLIENT_STREAM_WRITE_TIMEOUT_MS  (1000)
+#define SNAPCLIENT_STREAM_OUT_QUEUE_LEN     (4)
 #define SNAPCLIENT_STREAM_TASK_PRIO         (5)
 #define SNAPCLIENT_STREAM_TASK_CORE         (0)
 #define SNAPCLIENT_STREAM_CLIENT_NAME       ("esp32")
-#define SNAPCLIENT_STREAM_RINGBUFFER_SIZE     (20 * 1024)
+#define SNAPCLIENT_STREAM_RINGBUFFER_SIZE     (20 * 1024)   /*!< Chunks are released just in time, this is ~100 ms of 48 kHz stereo */
+#define SNAPCLIENT_STREAM_JITTER_BUFFER_SIZE  (96 * 1024)    /*!< 500 ms of 48 kHz stereo pcm, several seconds compressed */
+#define SNAPCLIENT_STREAM_HEAP_RESERVE        (48 * 1024)    /*!< Free heap the jitter buffer leaves to the rest of the system */
+#define SNAPCLIENT_STREAM_JITTER_CHUNKS       (64)      /*!< Until the buffer settings are known */
+#define SNAPCLIENT_STREAM_CHUNK_MS            (20)      /*!< Chunk duration assumed until measured */
+#define SNAPCLIENT_STREAM_JITTER_MARGIN       (4)       /*!< Room above the play out delay, in quarters */
+#define SNAPCLIENT_STREAM_TUNE_CHUNKS         (500)     /*!< Chunks between two latency recommendations */
+#define SNAPCLIENT_STREAM_TUNE_QUANTILE       (0.999)   /*!< Chunks a recommendation must keep on time */
+#define SNAPCLIENT_STREAM_TUNE_MARGIN_MS      (20)
+#define SNAPCLIENT_STREAM_TUNE_STEP_MS        (10)      /*!< Recommendations are rounded up to this much */
+#define SNAPCLIENT_STREAM_TUNE_MIN_CHANGE_MS  (20)      /*!< Smallest change of the recommended delay */
+#define SNAPCLIENT_STREAM_TUNE_LOWER_WINDOWS  (3)       /*!< Recommendations in a row below the current one before it is lowered */
+#define SNAPCLIENT_STREAM_POLL_MS             (20)      /*!< Longest read wait while chunks are pending */
+#define SNAPCLIENT_STREAM_LATE_TOLERANCE_MS   (40)      /*!< Default lateness before a chunk is dropped */
+#define SNAPCLIENT_STREAM_RESYNC_MS           (200)     /*!< Lateness after which playback is lined up again */
+#define SNAPCLIENT_STREAM_FADE_FRAMES         (256)     /*!< Fade out before a gap and in after it, 5 ms at 48 kHz */
+#define SNAPCLIENT_STREAM_GAP_FILL_MS         (2 * SNAPCLIENT_STREAM_POLL_MS)   /*!< Silence kept queued during a gap */
+#define SNAPCLIENT_STREAM_DECODE_AHEAD_MS     (100)     /*!< Default bound on the decode ahead margin */
+#define SNAPCLIENT_STREAM_DECODE_WINDOW       (250)     /*!< Releases over which the margin may shrink, 5 s of 20 ms chunks */
 
 #define SNAPCLIENT_STREAM_CFG_DEFAULT() {              \
     .type          = AUDIO_STREAM_READER,       \
     .out_rb_size   = SNAPCLIENT_STREAM_RINGBUFFER_SIZE,  \
     .timeout_ms    = 30 *1000,                  \
+    .jitter_buffer_size = SNAPCLIENT_STREAM_JITTER_BUFFER_SIZE, \
+    .late_tolerance_ms = SNAPCLIENT_STREAM_LATE_TOLERANCE_MS, \
+    .auto_latency  = false,                     \
+    .decoder       = false,                     \
+    .decode_ahead_ms = SNAPCLIENT_STREAM_DECODE_AHEAD_MS, \
     .port          = SNAPCLIENT_DEFAULT_PORT,   \
     .host          = NULL,                      \
     .task_stack    = SNAPCLIENT_STREAM_TASK_STACK,     \
@@ -79,6 +152,50 @@ typedef struct {
  */
 audio_element_handle_t snapclient_stream_init(snapclient_stream_cfg_t *config);
 
+/**
+ * @brief       Current time of the snapserver clock, estimated from the
+ *              Time message exchanges of the open stream
+ *
+ * @return     The server time in microseconds, 0 before the first exchange
+ */
+int64_t snapclient_server_now_us(void);
+
+/**
+ * @brief       Report the latency after the element to the scheduler, which
+ *              then releases chunks that much earlier
+ *
+ * @param      el   The snapclient stream element
+ * @param      el            The snapclient stream element
+ * @param      cb            Gives the frames queued downstream, NULL for none
+ * @param      ctx           Passed to cb
+ * @param      fixed_frames  Frames of those that stay queued when the stream
+ *                           stops writing, like the I2S DMA buffers
+ *
+ * @return     ESP_OK on success
+ */
+esp_err_t snapclient_stream_set_downstream(audio_element_handle_t el,
+                                           snapclient_stream_downstream_cb cb, void *ctx,
+                                           uint32_t fixed_frames);
+
+/**
+ * @brief       Get the playback statistics
+ *
+ * @param      el     The snapclient stream element
+ * @param      stats  The statistics
+ *
+ * @return     ESP_OK on success
+ */
+esp_err_t snapclient_stream_get_stats(audio_element_handle_t el, snapclient_stream_stats_t *stats);
+
+/**
+ * @brief       Estimated skew of the snapserver clock relative to the local
+ *              one, for continuous drift correction on the playback side
+ *
+ * @return     The skew in ppm, positive when the server clock runs faster,
+ *             0 until enough Time exchanges were made
+ */
+double snapclient_clock_skew_ppm(void);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,93 @@
+#ifndef _SYNC_SCHEDULER_H_
+#define _SYNC_SCHEDULER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cadence of the Time message exchanges.
+ *
+ * Right after the Hello a burst of requests makes the estimator converge in
+ * about a second. The period then starts at SYNC_SCHEDULER_MIN_INTERVAL_MS
+ * and doubles after every few replies agreeing with the estimate, up to
+ * SYNC_SCHEDULER_MAX_INTERVAL_MS. Reliable (low round trip) replies
+ * disagreeing with the estimate start a new burst and bring the period back
+ * to the minimum.
+ *
+ * Replies are matched to requests by id, unknown or duplicate ones are
+ * ignored. Enough requests are remembered for replies taking up to
+ * SYNC_SCHEDULER_MAX_RTT_MS during a burst: the slow, congested exchanges
+ * must reach the estimator, which rejects them. Like time_sync, this is
+ * plain C that runs on the host.
+ */
+
+#define SYNC_SCHEDULER_BURST            10      /*!< Requests sent right after the Hello */
+#define SYNC_SCHEDULER_BURST_INTERVAL_MS 100
+#define SYNC_SCHEDULER_MIN_INTERVAL_MS  1000
+#define SYNC_SCHEDULER_MAX_INTERVAL_MS  4000
+#define SYNC_SCHEDULER_STABLE_REPLIES   4       /*!< Agreeing replies before backing off */
+#define SYNC_SCHEDULER_UNSTABLE_REPLIES 2       /*!< Disagreeing replies before speeding up */
+#define SYNC_SCHEDULER_MAX_RESIDUAL_US  500     /*!< Largest agreeing difference with the estimate */
+#define SYNC_SCHEDULER_MAX_RTT_MS       2000    /*!< Slowest reply still matched to its request */
+#define SYNC_SCHEDULER_PENDING          (SYNC_SCHEDULER_MAX_RTT_MS / SYNC_SCHEDULER_BURST_INTERVAL_MS + 1)  /*!< Requests awaiting a reply */
+
+typedef struct sync_scheduler {
+    uint16_t    pending[SYNC_SCHEDULER_PENDING];    /*!< Ids of the last requests */
+    bool        pending_valid[SYNC_SCHEDULER_PENDING];
+    size_t      pending_next;
+    int         burst;          /*!< Burst requests left to send */
+    int         stable;         /*!< Consecutive agreeing replies */
+    int         unstable;       /*!< Consecutive disagreeing replies */
+    uint32_t    interval_ms;    /*!< Period once the burst is over */
+    uint32_t    requests;       /*!< Requests sent so far */
+} sync_scheduler_t;
+
+/**
+ * @brief      Reset the scheduler and start a burst
+ *
+ * @param      scheduler  The scheduler
+ */
+void sync_scheduler_init(sync_scheduler_t *scheduler);
+
+/**
+ * @brief      Record a sent request
+ *
+ * @param      scheduler  The scheduler
+ * @param      id         The id of the request
+ *
+ * @return     The delay before the next request, in milliseconds
+ */
+uint32_t sync_scheduler_sent(sync_scheduler_t *scheduler, uint16_t id);
+
+/**
+ * @brief      Match a reply and adapt the period
+ *
+ * @param      scheduler    The scheduler
+ * @param      refersTo     The id of the request the reply answers
+ * @param      residual_us  Difference between the sample offset and the
+ *                          estimate before the sample was added
+ * @param      reliable     Whether the sample round trip is among the
+ *                          lowest of the estimator window
+ *
+ * @return     -1 if the reply matches no pending request, 1 if the period
+ *             was shortened (the next request should be rescheduled), 0
+ *             otherwise
+ */
+int sync_scheduler_reply(sync_scheduler_t *scheduler, uint16_t refersTo,
+                         int64_t residual_us, bool reliable);
+
+/**
+ * @brief      Delay before the next request, in milliseconds
+ */
+uint32_t sync_scheduler_next_ms(const sync_scheduler_t *scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
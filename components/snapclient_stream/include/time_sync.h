@@ -0,0 +1,114 @@
+#ifndef _TIME_SYNC_H_
+#define _TIME_SYNC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Server clock estimator.
+ *
+ * Every Time message exchange gives one sample of the offset between the
+ * server and client clocks, (c2s - s2c) / 2, whose error is bounded by half
+ * of the round trip time c2s + s2c. Samples are kept in a sliding window and
+ * the estimate is the median offset of the samples with the lowest round
+ * trip times: the fast exchanges carry the least queuing jitter, and the
+ * median drops the asymmetric ones among them.
+ *
+ * This is plain C without any platform dependency so that it can be
+ * exercised on the host.
+ */
+
+#define TIME_SYNC_WINDOW        50      /*!< Number of samples kept */
+#define TIME_SYNC_MIN_SELECTED  3       /*!< Lowest round trip samples used, at least */
+#define TIME_SYNC_MIN_REGRESSION 8      /*!< Selected samples needed to estimate the skew */
+#define TIME_SYNC_HISTORY       16      /*!< Past estimates kept for the skew regression */
+#define TIME_SYNC_HISTORY_INTERVAL_US (25 * 1000000LL)  /*!< Time between two of them */
+#define TIME_SYNC_MAX_SKEW_PPM  500     /*!< Larger skews are clamped */
+
+typedef struct time_sync_sample {
+    int64_t local_us;       /*!< Client time when the reply was received */
+    int64_t offset_us;      /*!< Server time - client time */
+    int64_t rtt_us;         /*!< Round trip time */
+} time_sync_sample_t;
+
+typedef struct time_sync_point {
+    int64_t local_us;
+    int64_t offset_us;
+} time_sync_point_t;
+
+typedef struct time_sync_estimate {
+    int64_t local_us;       /*!< Client time the estimate is anchored at */
+    int64_t offset_us;      /*!< Server time - client time at local_us */
+    double  skew;           /*!< Offset change per client microsecond */
+} time_sync_estimate_t;
+
+typedef struct time_sync {
+    time_sync_sample_t  samples[TIME_SYNC_WINDOW];  /*!< Ring of the last samples */
+    size_t              count;
+    size_t              next;
+    time_sync_point_t   history[TIME_SYNC_HISTORY];    /*!< Ring of past estimates */
+    size_t              history_count;
+    size_t              history_next;
+    int64_t             history_last_us;    /*!< Client time of the last history point */
+    time_sync_estimate_t estimates[2];  /*!< Current estimate and the one being updated */
+    uint32_t            sequence;       /*!< Twice the estimate updates, odd during one, the current estimate is estimates[(sequence >> 1) & 1] */
+    int64_t             rtt_us;         /*!< Highest round trip of the samples used */
+} time_sync_t;
+
+/**
+ * @brief      Reset the estimator, dropping all samples
+ *
+ * @param      sync  The estimator
+ */
+void time_sync_init(time_sync_t *sync);
+
+/**
+ * @brief      Add the sample given by a Time message exchange and update the
+ *             estimate
+ *
+ * @param      sync      The estimator
+ * @param      local_us  Client time when the reply was received
+ * @param      c2s_us    Client to server latency, from the Time message
+ * @param      s2c_us    Server to client latency, reply received - sent
+ *
+ * @return     1 if the sample was rejected (negative round trip), 0 otherwise
+ */
+int time_sync_add(time_sync_t *sync, int64_t local_us, int64_t c2s_us, int64_t s2c_us);
+
+/**
+ * @brief      Whether an estimate is available
+ */
+bool time_sync_is_valid(const time_sync_t *sync);
+
+/**
+ * @brief      Convert a client time to server time
+ *
+ * May be called from another task than the one adding samples.
+ *
+ * @param      sync      The estimator
+ * @param      local_us  The client time
+ *
+ * @return     The server time, or local_us while no sample was added
+ */
+int64_t time_sync_server_time(const time_sync_t *sync, int64_t local_us);
+
+/**
+ * @brief      Estimated skew of the server clock relative to the client one
+ *
+ * @param      sync  The estimator
+ *
+ * @return     The skew in ppm, positive when the server clock runs faster,
+ *             0 until enough samples were added
+ */
+double time_sync_skew_ppm(const time_sync_t *sync);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
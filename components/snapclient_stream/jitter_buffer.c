@@ -0,0 +1,226 @@
+#include "jitter_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapclient_clock.h"
+
+int jitter_buffer_init(jitter_buffer_t *jb, size_t capacity, size_t max_bytes) {
+    memset(jb, 0, sizeof(*jb));
+
+    jb->entries = calloc(capacity, sizeof(jitter_buffer_entry_t));
+    if (!jb->entries) {
+        return 2;
+    }
+
+    jb->capacity = capacity;
+    jb->max_bytes = max_bytes;
+    return 0;
+}
+
+int jitter_buffer_resize(jitter_buffer_t *jb, size_t capacity, size_t max_bytes) {
+    jitter_buffer_entry_t *entries;
+    size_t i;
+
+    entries = calloc(capacity, sizeof(jitter_buffer_entry_t));
+    if (!entries) {
+        return 2;
+    }
+
+    jb->max_bytes = max_bytes;
+    while (jb->count && (jb->count > capacity || jb->bytes > max_bytes)) {
+        jitter_buffer_pop(jb);
+        jb->stats.overflows++;
+    }
+
+    for (i = 0; i < jb->count; i++) {
+        entries[i] = jb->entries[(jb->head + i) % jb->capacity];
+    }
+    free(jb->entries);
+    jb->entries = entries;
+    jb->capacity = capacity;
+    jb->head = 0;
+    return 0;
+}
+
+void jitter_buffer_deinit(jitter_buffer_t *jb) {
+    jitter_buffer_clear(jb);
+    free(jb->entries);
+    jb->entries = NULL;
+    jb->capacity = 0;
+}
+
+void jitter_buffer_clear(jitter_buffer_t *jb) {
+    while (jb->count) {
+        jitter_buffer_pop(jb);
+    }
+    jb->last_us = 0;
+    jb->chunk_us = 0;
+}
+
+void jitter_buffer_set_delay(jitter_buffer_t *jb, int64_t delay_us) {
+    jb->delay_us = delay_us;
+}
+
+int jitter_buffer_push(jitter_buffer_t *jb, wire_chunk_message_t *chunk) {
+    int64_t timestamp_us = tv_to_us(chunk->timestamp);
+    jitter_buffer_entry_t *entry;
+
+    // TCP keeps the chunks in order, this only happens across a server
+    // stream switch, where the new chunks start over anyway
+    if (jb->count && timestamp_us < jb->last_us) {
+        jb->stats.reordered++;
+        return 1;
+    }
+
+    // Out of heap, older chunks make room as when the buffer is full
+    while (wire_chunk_message_own(chunk)) {
+        jb->stats.overflows++;
+        if (!jb->count) {
+            return 2;
+        }
+        jitter_buffer_pop(jb);
+    }
+
+    while (jb->count && (jb->count == jb->capacity || jb->bytes + chunk->size > jb->max_bytes)) {
+        jitter_buffer_pop(jb);
+        jb->stats.overflows++;
+    }
+
+    if (jb->last_us && timestamp_us > jb->last_us) {
+        jb->chunk_us = timestamp_us - jb->last_us;
+    }
+
+    entry = &(jb->entries[(jb->head + jb->count) % jb->capacity]);
+    entry->timestamp_us = timestamp_us;
+    entry->chunk = *chunk;
+    chunk->chunk = NULL;
+    chunk->payload = NULL;
+
+    jb->count++;
+    jb->bytes += entry->chunk.size;
+    jb->last_us = timestamp_us;
+    jb->stats.pushed++;
+    return 0;
+}
+
+jitter_buffer_entry_t *jitter_buffer_peek(jitter_buffer_t *jb) {
+    return jb->count ? &(jb->entries[jb->head]) : NULL;
+}
+
+void jitter_buffer_pop(jitter_buffer_t *jb) {
+    jitter_buffer_entry_t *entry = jitter_buffer_peek(jb);
+
+    if (!entry) {
+        return;
+    }
+
+    jb->bytes -= entry->chunk.size;
+    wire_chunk_message_free(&(entry->chunk));
+    jb->head = (jb->head + 1) % jb->capacity;
+    jb->count--;
+}
+
+jitter_buffer_entry_t *jitter_buffer_due(jitter_buffer_t *jb, int64_t now_us) {
+    jitter_buffer_entry_t *entry = jitter_buffer_peek(jb);
+
+    if (entry && jitter_buffer_play_time(jb, entry) <= now_us) {
+        return entry;
+    }
+    return NULL;
+}
+
+int64_t jitter_buffer_duration(const jitter_buffer_t *jb, const jitter_buffer_entry_t *entry,
+                               uint32_t rate, uint32_t frame_size) {
+    const jitter_buffer_entry_t *next;
+
+    if (frame_size && rate) {
+        return (int64_t) (entry->chunk.size / frame_size) * 1000000 / rate;
+    }
+
+    next = &(jb->entries[(entry - jb->entries + 1) % jb->capacity]);
+    if (next != &(jb->entries[(jb->head + jb->count) % jb->capacity])) {
+        return next->timestamp_us - entry->timestamp_us;
+    }
+    return jb->chunk_us;
+}
+
+size_t jitter_buffer_drop_late(jitter_buffer_t *jb, int64_t deadline_us, uint32_t rate,
+                               uint32_t frame_size, int64_t *dropped_us) {
+    jitter_buffer_entry_t *entry;
+    size_t dropped = 0;
+
+    *dropped_us = 0;
+    while ((entry = jitter_buffer_peek(jb)) && jitter_buffer_play_time(jb, entry) < deadline_us) {
+        *dropped_us += jitter_buffer_duration(jb, entry, rate, frame_size);
+        jitter_buffer_pop(jb);
+        dropped++;
+    }
+    return dropped;
+}
+
+// Whole frames closest to a duration, and back
+static int64_t jitter_buffer_frames(int64_t us, uint32_t rate) {
+    return (us * rate + 500000) / 1000000;
+}
+
+static int64_t jitter_buffer_frames_ns(int64_t frames, uint32_t rate) {
+    return frames * 1000000000 / rate;
+}
+
+jitter_buffer_entry_t *jitter_buffer_start(jitter_buffer_t *jb, int64_t now_us, int64_t lead_us,
+                                           uint32_t rate, uint32_t frame_size,
+                                           jitter_buffer_start_t *start) {
+    jitter_buffer_entry_t *entry;
+    int64_t play_us, early_us, frames, trim;
+
+    memset(start, 0, sizeof(*start));
+
+    while ((entry = jitter_buffer_peek(jb))) {
+        play_us = jitter_buffer_play_time(jb, entry);
+        early_us = play_us - now_us;
+
+        if (early_us > lead_us) {
+            return NULL;
+        }
+
+        if (!frame_size || !rate) {
+            // Already partly over, start on the next chunk instead
+            if (early_us < 0) {
+                jitter_buffer_pop(jb);
+                start->dropped_chunks++;
+                continue;
+            }
+            start->play_us = play_us;
+            start->wait_us = early_us;
+            return entry;
+        }
+
+        if (early_us >= 0) {
+            frames = jitter_buffer_frames(early_us, rate);
+            start->play_us = play_us;
+            start->silence_frames = frames;
+            start->error_ns = jitter_buffer_frames_ns(frames, rate) - early_us * 1000;
+            return entry;
+        }
+
+        trim = jitter_buffer_frames(-early_us, rate);
+        if (trim >= entry->chunk.size / frame_size) {
+            jitter_buffer_pop(jb);
+            start->dropped_chunks++;
+            continue;
+        }
+
+        entry->chunk.payload += trim * frame_size;
+        entry->chunk.size -= trim * frame_size;
+        jb->bytes -= trim * frame_size;
+        entry->timestamp_us += (trim * 1000000 + rate / 2) / rate;
+
+        start->play_us = play_us + jitter_buffer_frames_ns(trim, rate) / 1000;
+        start->trimmed_frames = trim;
+        start->error_ns = -early_us * 1000 - jitter_buffer_frames_ns(trim, rate);
+        return entry;
+    }
+
+    return NULL;
+}
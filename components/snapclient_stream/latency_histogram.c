@@ -0,0 +1,56 @@
+#include "latency_histogram.h"
+
+#include <string.h>
+
+void latency_histogram_init(latency_histogram_t *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+static void latency_histogram_decay(latency_histogram_t *histogram) {
+    size_t i;
+
+    histogram->count = 0;
+    for (i = 0; i < LATENCY_HISTOGRAM_BINS; i++) {
+        histogram->bins[i] /= 2;
+        histogram->count += histogram->bins[i];
+    }
+    histogram->added = 0;
+    histogram->max_us = 0;
+}
+
+void latency_histogram_add(latency_histogram_t *histogram, int64_t lateness_us) {
+    int64_t bin = lateness_us / LATENCY_HISTOGRAM_BIN_US;
+
+    // early arrivals only come from time sync errors
+    if (bin < 0) {
+        bin = 0;
+    } else if (bin >= LATENCY_HISTOGRAM_BINS) {
+        bin = LATENCY_HISTOGRAM_BINS - 1;
+    }
+
+    if (histogram->bins[bin] == UINT16_MAX || histogram->added == LATENCY_HISTOGRAM_DECAY) {
+        latency_histogram_decay(histogram);
+    }
+    histogram->bins[bin]++;
+    histogram->count++;
+    histogram->added++;
+    if (lateness_us > histogram->max_us) {
+        histogram->max_us = lateness_us;
+    }
+}
+
+int64_t latency_histogram_quantile(const latency_histogram_t *histogram, double fraction) {
+    uint32_t target = (uint32_t) (histogram->count * fraction), seen = 0;
+    size_t i;
+
+    for (i = 0; i < LATENCY_HISTOGRAM_BINS; i++) {
+        seen += histogram->bins[i];
+        if (seen > target) {
+            break;
+        }
+    }
+    if (i == LATENCY_HISTOGRAM_BINS) {
+        i--;
+    }
+    return (int64_t) (i + 1) * LATENCY_HISTOGRAM_BIN_US;
+}
@@ -0,0 +1,84 @@
+#include "esp_log.h"
+#include "ringbuf.h"
+#include "playback_position.h"
+
+static const char *TAG = "PLAYBACK_POSITION";
+
+void playback_position_init(playback_position_t *position, audio_element_handle_t sink,
+                            int dma_buf_count, int dma_buf_len)
+{
+    position->count = 0;
+    position->sink = sink;
+    position->dma_frames = dma_buf_count * dma_buf_len;
+    position->codec_frames = 0;
+}
+
+void playback_position_set_dma(playback_position_t *position, int dma_buf_count, int dma_buf_len)
+{
+    position->dma_frames = dma_buf_count * dma_buf_len;
+}
+
+esp_err_t playback_position_add(playback_position_t *position, audio_element_handle_t el)
+{
+    if (position->count == PLAYBACK_POSITION_MAX_ELEMENTS) {
+        ESP_LOGE(TAG, "Too many elements");
+        return ESP_FAIL;
+    }
+    position->elements[position->count++] = el;
+    return ESP_OK;
+}
+
+uint32_t playback_position_frames(void *ctx)
+{
+    playback_position_t *position = (playback_position_t *)ctx;
+    audio_element_info_t info = {0};
+    ringbuf_handle_t rb;
+    uint32_t bytes = 0;
+    int i, frame_size;
+
+    audio_element_getinfo(position->sink, &info);
+    frame_size = info.bits / 8 * info.channels;
+
+    for (i = 0; i < position->count; i++) {
+        rb = audio_element_get_input_ringbuf(position->elements[i]);
+        if (rb) {
+            bytes += rb_bytes_filled(rb);
+        }
+    }
+
+    return (frame_size > 0 ? bytes / frame_size : 0) + playback_position_fixed_frames(position);
+}
+
+uint32_t playback_position_fixed_frames(const playback_position_t *position)
+{
+    return position->dma_frames + position->codec_frames;
+}
+
+void playback_position_dma_config(int rate, int frame_size, int latency_ms,
+                                  int *dma_buf_count, int *dma_buf_len)
+{
+    int frames = rate * latency_ms / 1000;
+    int len = PLAYBACK_POSITION_DMA_BYTES_MAX / frame_size;
+    int count;
+
+    if (len > PLAYBACK_POSITION_DMA_LEN_MAX) {
+        len = PLAYBACK_POSITION_DMA_LEN_MAX;
+    }
+    count = (frames + len - 1) / len;
+    if (count < PLAYBACK_POSITION_DMA_BUF_MIN) {
+        count = PLAYBACK_POSITION_DMA_BUF_MIN;
+    } else if (count > PLAYBACK_POSITION_DMA_BUF_MAX) {
+        count = PLAYBACK_POSITION_DMA_BUF_MAX;
+    }
+    // spread the latency evenly over the buffers, 8 frames at least for
+    // the driver
+    len = (frames + count - 1) / count;
+    if (len < 8) {
+        len = 8;
+    } else if (len > PLAYBACK_POSITION_DMA_BYTES_MAX / frame_size) {
+        len = PLAYBACK_POSITION_DMA_BYTES_MAX / frame_size;
+    }
+
+    *dma_buf_count = count;
+    *dma_buf_len = len;
+}
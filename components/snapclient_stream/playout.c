@@ -0,0 +1,22 @@
+#include "playout.h"
+
+int64_t playout_buffered_us(const playout_level_t *level) {
+    int64_t buffered_us = level->play_now_us - level->now_us - level->fixed_us;
+
+    return buffered_us > 0 ? buffered_us : 0;
+}
+
+uint32_t playout_gap_frames(const playout_level_t *level, int64_t fill_us, uint32_t rate) {
+    int64_t missing_us = fill_us - playout_buffered_us(level);
+
+    if (missing_us <= 0) {
+        return 0;
+    }
+    return missing_us * rate / 1000000;
+}
+
+int64_t playout_hold_us(const playout_level_t *level, int64_t lead_us, int64_t poll_us) {
+    int64_t hold_us = playout_buffered_us(level) - lead_us - poll_us;
+
+    return hold_us > 0 ? hold_us : 0;
+}
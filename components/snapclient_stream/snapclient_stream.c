@@ -1,19 +1,45 @@
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_heap_caps.h"
 #include "lwip/sockets.h"
 #include "esp_transport_tcp.h"
 #include "audio_mem.h"
 #include "snapclient_stream.h"
 #include "snapcast.h"
+#include "framer.h"
+#include "message_builder.h"
+#include "time_sync.h"
+#include "sync_scheduler.h"
+#include "snapclient_clock.h"
+#include "jitter_buffer.h"
+#include "latency_histogram.h"
+#include "playout.h"
+#include "buffer.h"
 #include "audio_element.h"
 #include "ringbuf.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
 
 static const char *TAG = "SNAPCLIENT_STREAM";
 #define CONNECT_TIMEOUT_MS        100
+#define HELLO_MESSAGE_BUF_SIZE    512
+#define OUTBOUND_PAYLOAD_SIZE     (HELLO_MESSAGE_BUF_SIZE - BASE_MESSAGE_SIZE)
+
+/*
+ * Message handed to the writer task. The payload is either serialized by the
+ * sender in storage that outlives the send (the Hello), or built by the
+ * writer itself under the sync lock (Time requests). The base header is only
+ * added by the writer right before sending.
+ */
+typedef struct snapclient_outbound {
+	uint16_t type;          // SNAPCAST_MESSAGE_*, SNAPCAST_MESSAGE_BASE stops the writer
+	uint16_t size;
+	const char *payload;    // NULL for Time requests
+} snapclient_outbound_t;
 
 
 typedef struct snapclient_stream {
@@ -22,77 +48,118 @@ typedef struct snapclient_stream {
     int                           sock;
     int                           port;
     char                          *host;
-    bool                          is_open;
+    bool                          is_open;      // changed under both write_lock and sync_lock
     int                           timeout_ms;
     snapclient_stream_event_handle_cb    hook;
     void                          *ctx;
 	// snapclient structures; we keep one message struct of each type
 	bool  received_header;
-	struct timeval last_sync;
+	int64_t last_sync_us;
+	int64_t read_us;    // arrival time of the last read bytes
 	int id_counter;
 	base_message_t base_message;
 	codec_header_message_t codec_header_message;
+	sample_format_t sample_format;
+	uint32_t frame_size;    // bytes per frame of pcm streams, 0 for compressed ones
+	bool started;           // playback lined up on the schedule
+	bool playing;           // output since the stream started, silence included
+	bool in_gap;            // ran dry, waiting for chunks to rejoin
+	int64_t late_tolerance_us;  // chunks later than this are dropped
+	int64_t late_us;        // total duration of the dropped chunks
+	int jitter_ceiling;     // bytes the jitter buffer may use at most
+	int64_t sized_chunk_us; // chunk duration the jitter buffer was sized for
+	uint32_t overflows;     // jitter buffer overflows already reported
+	latency_histogram_t lateness;   // chunk arrival lateness
+	uint32_t tune_chunks;   // chunks since the last recommendation
+	int32_t recommended_ms; // last recommended delay, 0 for none
+	uint32_t tune_lower;    // recommendations in a row below it
+	int32_t tune_lower_ms;  // highest of those
+	bool auto_latency;
+	bool decoder;           // compressed chunks are decoded downstream
+	int64_t decode_ahead_us;    // compressed chunks go to the decoder this early
+	int64_t decode_ahead_max_us;
+	int64_t decode_latency_us;  // released audio the decoder is seen holding
+	int64_t decode_peak_us;     // most of it in the current window
+	uint32_t decode_releases;   // releases in the current window
+	int64_t released_end_us;    // play time the released compressed audio ends at
+	uint32_t sized_chunk_bytes; // compressed chunk size the jitter buffer was sized for
+	bool fade_in;           // fade the next chunk in, after a gap
+	int64_t gap_start_us;   // play time the gap started at
+	int64_t hold_end_us;    // local time the last chunk is held until, 0 if none
+	int64_t gap_us;         // total time spent in gaps
+	snapclient_stream_stats_t stats;
+	char fade_buffer[SNAPCLIENT_STREAM_FADE_FRAMES * 2 * sizeof(int16_t)];
+	snapclient_stream_downstream_cb downstream;    // frames queued after the element
+	void *downstream_ctx;
+	uint32_t downstream_fixed;  // frames of those that never drain
 	wire_chunk_message_t wire_chunk_message;
 	server_settings_message_t server_settings_message;
-	time_message_t time_message;
+	time_message_t time_message;    // last reply, sent back in the requests under sync_lock
+	char hello_payload[OUTBOUND_PAYLOAD_SIZE];
+	stream_tags_message_t stream_tags_message;
+	stream_tags_message_t stream_tags_scratch;  // parsed into, the tags are kept if that fails
+	time_sync_t time_sync;
+	jitter_buffer_t jitter_buffer;
+	sync_scheduler_t sync_scheduler;
+	SemaphoreHandle_t sync_lock;    // ids and scheduler state, shared by the writer and element tasks
+	SemaphoreHandle_t write_lock;   // held across socket writes, and to open or close the socket
+	TimerHandle_t sync_timer;       // one-shot, queues the next Time request
+	QueueHandle_t out_queue;        // messages for the writer task
+	SemaphoreHandle_t writer_done;  // given by the writer task when it exits
+	framer_t framer;
+	char *frame_buffer;
 
 } snapclient_stream_t;
 
 static snapclient_stream_t *snapclient = NULL;
-static TimerHandle_t        send_time_tm_handle;
-static void send_time_timer_cb(TimerHandle_t xTimer)
+
+/*
+ * Stamp the id and send time of a built message, under sync_lock. The frame,
+ * header and payload together, is then sent in a single write.
+ */
+static int _snapclient_stamp(snapclient_stream_t *snapclient, message_builder_t *builder, size_t *length)
 {
-    ESP_LOGD(TAG, "Send time cb");
-    struct timeval now;
-	char message_serialized[BASE_MESSAGE_SIZE];
+	int64_t now_us = snapclient_clock_now_us();
 
-	if (snapclient == NULL) {
-		ESP_LOGI(TAG, "snapclient not initialized, ignoring");
-		return;
+	if (message_builder_finish(builder, snapclient->id_counter++,
+							   tv_from_us(now_us), length)) {
+		ESP_LOGE(TAG, "Failed to serialize base message\r\n");
+		return ESP_FAIL;
 	}
-	if (!snapclient->received_header) {
-		ESP_LOGI(TAG, "NO Codec HEADER received, (not) ignoring");
-		return;
+
+	if (builder->type == SNAPCAST_MESSAGE_TIME) {
+		snapclient->last_sync_us = now_us;
 	}
+	return ESP_OK;
+}
 
-	if (gettimeofday(&now, NULL)) {
-		ESP_LOGI(TAG, "Failed to gettimeofday\r\n");
-		return;
+int64_t snapclient_server_now_us(void)
+{
+	if (snapclient == NULL || !time_sync_is_valid(&(snapclient->time_sync))) {
+		return 0;
 	}
-	snapclient->last_sync.tv_sec = now.tv_sec;
-	snapclient->last_sync.tv_usec = now.tv_usec;
+	return time_sync_server_time(&(snapclient->time_sync), snapclient_clock_now_us());
+}
 
-	base_message_t base_message = {
-		SNAPCAST_MESSAGE_TIME,      // type
-		snapclient->id_counter++,   // id
-		0x0,                         // refersTo
-		{ now.tv_sec, now.tv_usec }, // sent
-		{ 0x0, 0x0 },                // received
-		TIME_MESSAGE_SIZE           // size
-	};
+esp_err_t snapclient_stream_set_downstream(audio_element_handle_t el,
+										   snapclient_stream_downstream_cb cb, void *ctx,
+										   uint32_t fixed_frames)
+{
+	snapclient_stream_t *snapclient = (snapclient_stream_t *)audio_element_getdata(el);
+	AUDIO_NULL_CHECK(TAG, snapclient, return ESP_FAIL);
 
-	if (base_message_serialize(
-			&base_message,
-			message_serialized,
-			BASE_MESSAGE_SIZE)) {
-		ESP_LOGE(TAG, "Failed to serialize base message for time\r\n");
-		return;
-	}
-	esp_transport_write(snapclient->t,
-						message_serialized, BASE_MESSAGE_SIZE,
-						snapclient->timeout_ms);
+	snapclient->downstream = cb;
+	snapclient->downstream_ctx = ctx;
+	snapclient->downstream_fixed = fixed_frames;
+	return ESP_OK;
+}
 
-	if (time_message_serialize(
-			&(snapclient->time_message),
-			message_serialized,
-			TIME_MESSAGE_SIZE)) {
-		ESP_LOGI(TAG, "Failed to serialize time message\r\b");
-		return;
+double snapclient_clock_skew_ppm(void)
+{
+	if (snapclient == NULL) {
+		return 0;
 	}
-	esp_transport_write(snapclient->t,
-						message_serialized, TIME_MESSAGE_SIZE,
-						snapclient->timeout_ms);
-	ESP_LOGD(TAG, "SENT time message");
+	return time_sync_skew_ppm(&(snapclient->time_sync));
 }
 
 static int _get_socket_error_code_reason(char *str, int sockfd)
@@ -126,11 +193,660 @@ static esp_err_t _dispatch_event(audio_element_handle_t el, snapclient_stream_t
 }
 
 
+/*
+ * Writer task, owning all the outbound traffic so that neither the element
+ * task nor the timer service task ever blocks on a socket write. sync_lock
+ * is only held to build the message, never across the write, which may
+ * block for SNAPCLIENT_STREAM_WRITE_TIMEOUT_MS.
+ */
+static void _snapclient_writer_task(void *arg)
+{
+	snapclient_stream_t *snapclient = (snapclient_stream_t *) arg;
+	char message_serialized[HELLO_MESSAGE_BUF_SIZE];
+	snapclient_outbound_t outbound;
+	message_builder_t builder;
+	uint32_t next_ms = 0;
+	size_t length;
+	uint16_t id;
+	int result;
+
+	while (xQueueReceive(snapclient->out_queue, &outbound, portMAX_DELAY) == pdTRUE) {
+		if (outbound.type == SNAPCAST_MESSAGE_BASE) {
+			break;
+		}
+
+		message_builder_begin(&builder, message_serialized, sizeof(message_serialized),
+							  outbound.type, 0);
+
+		xSemaphoreTake(snapclient->sync_lock, portMAX_DELAY);
+		// the connection may have been closed since the message was queued
+		if (!snapclient->is_open) {
+			xSemaphoreGive(snapclient->sync_lock);
+			continue;
+		}
+		if (outbound.payload) {
+			buffer_write_buffer(&(builder.buffer), outbound.payload, outbound.size);
+		} else {
+			time_message_encode(&(snapclient->time_message), &(builder.buffer));
+		}
+		id = snapclient->id_counter;
+		result = _snapclient_stamp(snapclient, &builder, &length);
+		if (outbound.type == SNAPCAST_MESSAGE_TIME) {
+			next_ms = sync_scheduler_sent(&(snapclient->sync_scheduler), id);
+		}
+		xSemaphoreGive(snapclient->sync_lock);
+
+		if (result == ESP_OK) {
+			xSemaphoreTake(snapclient->write_lock, portMAX_DELAY);
+			result = snapclient->is_open ?
+				esp_transport_write(snapclient->t, builder.buffer.buffer, length,
+									SNAPCLIENT_STREAM_WRITE_TIMEOUT_MS) : 0;
+			xSemaphoreGive(snapclient->write_lock);
+		}
+
+		if (outbound.type == SNAPCAST_MESSAGE_TIME) {
+			// rearm even on failure, the next request may go through
+			xTimerChangePeriod(snapclient->sync_timer, next_ms / portTICK_RATE_MS, 0);
+		}
+
+		if (result < 0) {
+			ESP_LOGW(TAG, "Failed to send message type %d", outbound.type);
+			_get_socket_error_code_reason("TCP write", snapclient->sock);
+			continue;
+		}
+		ESP_LOGD(TAG, "SENT message type %d id %d", outbound.type, id);
+	}
+
+	xSemaphoreGive(snapclient->writer_done);
+	vTaskDelete(NULL);
+}
+
+static void _snapclient_stop_writer(snapclient_stream_t *snapclient)
+{
+	snapclient_outbound_t outbound = { .type = SNAPCAST_MESSAGE_BASE };
+
+	xQueueSend(snapclient->out_queue, &outbound, portMAX_DELAY);
+	xSemaphoreTake(snapclient->writer_done, portMAX_DELAY);
+}
+
+/*
+ * Queue a message for the writer task, without waiting: a full queue means
+ * the link is stalled and a later message will do.
+ */
+static int _snapclient_queue(snapclient_stream_t *snapclient, snapclient_outbound_t *outbound)
+{
+	if (xQueueSend(snapclient->out_queue, outbound, 0) != pdTRUE) {
+		ESP_LOGW(TAG, "Outbound queue full, dropping message type %d", outbound->type);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/*
+ * One-shot timer queuing Time requests. The writer builds them, drops them
+ * once the connection is closed, and rearms the timer after each one with
+ * the delay chosen by the sync scheduler.
+ */
+static void send_time_timer_cb(TimerHandle_t xTimer)
+{
+	snapclient_stream_t *snapclient = (snapclient_stream_t *) pvTimerGetTimerID(xTimer);
+	snapclient_outbound_t outbound = { .type = SNAPCAST_MESSAGE_TIME };
+
+	if (_snapclient_queue(snapclient, &outbound) != ESP_OK) {
+		xTimerChangePeriod(xTimer, SYNC_SCHEDULER_MIN_INTERVAL_MS / portTICK_RATE_MS, 0);
+	}
+}
+
+static void _snapclient_output(audio_element_handle_t self, const char *data, int size)
+{
+	int w_size = audio_element_output(self, (char *) data, size);
+
+	if (w_size > 0) {
+		audio_element_update_byte_pos(self, w_size);
+	} else {
+		ESP_LOGI(TAG, "Not Inserted any data stream");
+	}
+}
+
+/*
+ * Lead time allowed for a start, filled with silence for pcm. Compressed
+ * starts wait for the play time of a chunk instead: the read waits end that
+ * much early, and a read wait may end up to a tick late.
+ */
+static int64_t _snapclient_start_lead_us(snapclient_stream_t *snapclient)
+{
+	return snapclient->frame_size ? SNAPCLIENT_STREAM_POLL_MS * 1000 : 2 * portTICK_PERIOD_MS * 1000;
+}
+
+static void _snapclient_output_silence(audio_element_handle_t self, snapclient_stream_t *snapclient, uint32_t frames)
+{
+	char silence[256];
+	uint32_t bytes, size;
+
+	// 8 bit pcm is unsigned
+	memset(silence, snapclient->sample_format.bits == 8 ? 0x80 : 0, sizeof(silence));
+	bytes = frames * snapclient->frame_size;
+	while (bytes) {
+		size = bytes < sizeof(silence) ? bytes : sizeof(silence) - sizeof(silence) % snapclient->frame_size;
+		_snapclient_output(self, silence, size);
+		bytes -= size;
+	}
+}
+
+/*
+ * Output a pcm chunk, fading its head in when rejoining after a gap and its
+ * tail out when no chunk follows it. Only 16 bit samples are faded, others
+ * are output as is.
+ */
+static void _snapclient_output_chunk(audio_element_handle_t self, snapclient_stream_t *snapclient,
+									 const jitter_buffer_entry_t *entry, bool fade_in, bool fade_out)
+{
+	const char *data = entry->chunk.payload;
+	uint32_t frames, fade, head, i, gain;
+	int16_t *samples;
+	int channels = snapclient->sample_format.channels, c;
+
+	if (!snapclient->frame_size || snapclient->sample_format.bits != 16 || (!fade_in && !fade_out)) {
+		_snapclient_output(self, data, entry->chunk.size);
+		return;
+	}
+
+	frames = entry->chunk.size / snapclient->frame_size;
+	fade = frames < SNAPCLIENT_STREAM_FADE_FRAMES ? frames : SNAPCLIENT_STREAM_FADE_FRAMES;
+	fade = fade * snapclient->frame_size <= sizeof(snapclient->fade_buffer) ?
+		fade : sizeof(snapclient->fade_buffer) / snapclient->frame_size;
+	if (!fade) {
+		_snapclient_output(self, data, entry->chunk.size);
+		return;
+	}
+	samples = (int16_t *) snapclient->fade_buffer;
+
+	head = 0;
+	if (fade_in) {
+		memcpy(samples, data, fade * snapclient->frame_size);
+		for (i = 0; i < fade; i++) {
+			gain = (i << 15) / fade;
+			for (c = 0; c < channels; c++) {
+				samples[i * channels + c] = (samples[i * channels + c] * (int32_t) gain) >> 15;
+			}
+		}
+		_snapclient_output(self, (char *) samples, fade * snapclient->frame_size);
+		head = fade;
+	}
+
+	if (!fade_out || frames - head <= fade) {
+		_snapclient_output(self, data + head * snapclient->frame_size,
+						   (frames - head) * snapclient->frame_size);
+		return;
+	}
+
+	_snapclient_output(self, data + head * snapclient->frame_size,
+					   (frames - head - fade) * snapclient->frame_size);
+	memcpy(samples, data + (frames - fade) * snapclient->frame_size, fade * snapclient->frame_size);
+	for (i = 0; i < fade; i++) {
+		gain = ((fade - 1 - i) << 15) / fade;
+		for (c = 0; c < channels; c++) {
+			samples[i * channels + c] = (samples[i * channels + c] * (int32_t) gain) >> 15;
+		}
+	}
+	_snapclient_output(self, (char *) samples, fade * snapclient->frame_size);
+}
+
+/*
+ * Line playback up on the schedule, after connecting, a stream change, a
+ * gap or a stall. For pcm the first output sample is the one scheduled for
+ * now, within a sample period; compressed streams can only start on a
+ * chunk.
+ */
+static bool _snapclient_start(audio_element_handle_t self, snapclient_stream_t *snapclient, int64_t now_us)
+{
+	jitter_buffer_start_t start;
+	int64_t gap_us;
+
+	// compressed output only plays once through the decoder
+	if (!snapclient->frame_size) {
+		now_us += snapclient->decode_latency_us;
+	}
+	if (!jitter_buffer_start(&(snapclient->jitter_buffer), now_us,
+							 _snapclient_start_lead_us(snapclient),
+							 snapclient->sample_format.rate, snapclient->frame_size, &start)) {
+		return false;
+	}
+
+	_snapclient_output_silence(self, snapclient, start.silence_frames);
+	// below the tick, only spinning gets a compressed chunk out on time
+	if (start.wait_us) {
+		int64_t until_us = snapclient_clock_now_us() + start.wait_us;
+
+		while (snapclient_clock_now_us() < until_us) {
+		}
+	}
+
+	ESP_LOGI(TAG, "Playback started: error %lld ns, %u silence, %u trimmed frames, %u chunks dropped",
+			 start.error_ns, start.silence_frames, start.trimmed_frames, start.dropped_chunks);
+	if (snapclient->in_gap) {
+		// the stream did not run dry if the next chunk came in time
+		gap_us = start.play_us - snapclient->gap_start_us;
+		if (gap_us > 0) {
+			snapclient->stats.gaps++;
+			snapclient->gap_us += gap_us;
+			snapclient->stats.gap_ms = snapclient->gap_us / 1000;
+			ESP_LOGW(TAG, "Rejoined after a %lld ms gap", gap_us / 1000);
+		}
+		snapclient->in_gap = false;
+		// the previous chunk was faded out either way
+		snapclient->fade_in = true;
+	}
+	snapclient->started = true;
+	snapclient->playing = true;
+	_dispatch_event(self, snapclient, &start, sizeof(start), SNAPCLIENT_STREAM_STATE_STARTED);
+	return true;
+}
+
+/*
+ * Server time at which the next output byte will reach the DAC: whatever
+ * is queued downstream plays first.
+ */
+static int64_t _snapclient_play_now_us(snapclient_stream_t *snapclient)
+{
+	int64_t now_us = time_sync_server_time(&(snapclient->time_sync), snapclient_clock_now_us());
+
+	if (snapclient->downstream && snapclient->sample_format.rate) {
+		now_us += (int64_t) snapclient->downstream(snapclient->downstream_ctx) * 1000000
+			/ snapclient->sample_format.rate;
+	}
+	return now_us;
+}
+
+static void _snapclient_playout_level(snapclient_stream_t *snapclient, playout_level_t *level)
+{
+	level->now_us = time_sync_server_time(&(snapclient->time_sync), snapclient_clock_now_us());
+	level->play_now_us = _snapclient_play_now_us(snapclient);
+	level->fixed_us = (int64_t) snapclient->downstream_fixed * 1000000 / snapclient->sample_format.rate;
+}
+
+// Compressed chunks are released this much before their play time
+static int64_t _snapclient_decode_ahead_us(snapclient_stream_t *snapclient)
+{
+	return snapclient->frame_size || !snapclient->decoder ? 0 : snapclient->decode_ahead_us;
+}
+
+static void _snapclient_reset_decode(snapclient_stream_t *snapclient)
+{
+	snapclient->decode_latency_us = SNAPCLIENT_STREAM_CHUNK_MS * 1000;
+	snapclient->decode_ahead_us = snapclient->decode_latency_us + SNAPCLIENT_STREAM_POLL_MS * 1000;
+	if (snapclient->decode_ahead_us > snapclient->decode_ahead_max_us) {
+		snapclient->decode_ahead_us = snapclient->decode_ahead_max_us;
+	}
+	snapclient->decode_peak_us = 0;
+	snapclient->decode_releases = 0;
+	snapclient->released_end_us = 0;
+	snapclient->stats.decode_ahead_ms = snapclient->decode_ahead_us / 1000;
+	snapclient->stats.decode_pending_ms = 0;
+}
+
+/*
+ * The downstream latency only counts pcm: released compressed audio
+ * ending past it is still waiting for the decoder. Sampled before each
+ * release, the peak of that backlog is the decoder latency. The decode ahead
+ * margin covers it plus a poll period, growing as soon as needed and
+ * shrinking to the peak of the last SNAPCLIENT_STREAM_DECODE_WINDOW
+ * releases, never above decode_ahead_max_us: chunks released early wait
+ * decoded downstream, in pcm. Without the downstream latency there is
+ * nothing to measure and the initial margin stays.
+ */
+static void _snapclient_measure_decode(snapclient_stream_t *snapclient, int64_t now_us)
+{
+	int64_t pending_us, latency_us;
+
+	if (snapclient->frame_size || !snapclient->downstream || !snapclient->released_end_us) {
+		return;
+	}
+
+	pending_us = snapclient->released_end_us - now_us;
+	if (pending_us < 0) {
+		pending_us = 0;
+	}
+	if (pending_us > snapclient->decode_peak_us) {
+		snapclient->decode_peak_us = pending_us;
+	}
+	if (pending_us / 1000 > snapclient->stats.decode_pending_ms) {
+		snapclient->stats.decode_pending_ms = pending_us / 1000;
+	}
+
+	latency_us = snapclient->decode_peak_us;
+	if (++snapclient->decode_releases == SNAPCLIENT_STREAM_DECODE_WINDOW) {
+		snapclient->decode_releases = 0;
+		snapclient->decode_peak_us = pending_us;
+	} else if (latency_us <= snapclient->decode_latency_us) {
+		return;
+	}
+
+	snapclient->decode_latency_us = latency_us;
+	snapclient->decode_ahead_us = latency_us + SNAPCLIENT_STREAM_POLL_MS * 1000;
+	if (snapclient->decode_ahead_us > snapclient->decode_ahead_max_us) {
+		snapclient->decode_ahead_us = snapclient->decode_ahead_max_us;
+	}
+	if (snapclient->stats.decode_ahead_ms != snapclient->decode_ahead_us / 1000) {
+		snapclient->stats.decode_ahead_ms = snapclient->decode_ahead_us / 1000;
+		ESP_LOGI(TAG, "Decode ahead %lld ms, decoder holding %lld ms",
+				 snapclient->decode_ahead_us / 1000, latency_us / 1000);
+	}
+}
+
+/*
+ * Keep the playback clock running through a gap, or while waiting for the
+ * chunk following late ones: silence keeps the downstream ring buffers at
+ * SNAPCLIENT_STREAM_GAP_FILL_MS, on top of the DMA buffers, so that the
+ * I2S driver never replays stale DMA buffers and the rejoin lands on time.
+ * This needs pcm and the downstream latency.
+ */
+static void _snapclient_fill_gap(audio_element_handle_t self, snapclient_stream_t *snapclient)
+{
+	playout_level_t level;
+
+	if (!snapclient->frame_size || !snapclient->downstream) {
+		return;
+	}
+
+	_snapclient_playout_level(snapclient, &level);
+	_snapclient_output_silence(self, snapclient,
+							   playout_gap_frames(&level, SNAPCLIENT_STREAM_GAP_FILL_MS * 1000,
+												  snapclient->sample_format.rate));
+}
+
+/*
+ * Size the jitter buffer for the play out delay announced by the server:
+ * bufferMs - latency of chunks, plus a margin, in the stream sample format.
+ * Compressed chunks are kept as received and decoded when released, so they
+ * are sized from the largest one seen, within their pcm size. Called again
+ * whenever the settings, the format, the chunk duration or that size change.
+ */
+static void _snapclient_size_buffers(snapclient_stream_t *snapclient)
+{
+	jitter_buffer_t *jb = &(snapclient->jitter_buffer);
+	int64_t delay_ms = jb->delay_us / 1000, chunk_us, bytes, ceiling, heap;
+	int frame_size = snapclient->sample_format.bits / 8 * snapclient->sample_format.channels;
+	size_t capacity;
+
+	if (delay_ms <= 0 || !snapclient->sample_format.rate || !frame_size) {
+		return;
+	}
+
+	chunk_us = jb->chunk_us ? jb->chunk_us : SNAPCLIENT_STREAM_CHUNK_MS * 1000;
+	delay_ms += delay_ms / SNAPCLIENT_STREAM_JITTER_MARGIN + chunk_us / 1000;
+	capacity = delay_ms * 1000 / chunk_us + 1;
+	bytes = delay_ms * snapclient->sample_format.rate / 1000 * frame_size;
+	if (!snapclient->frame_size && snapclient->sized_chunk_bytes
+		&& (int64_t) capacity * snapclient->sized_chunk_bytes < bytes) {
+		bytes = (int64_t) capacity * snapclient->sized_chunk_bytes;
+	}
+	// every chunk is its own allocation, do not plan for more than the
+	// heap holds (the buffered chunks are part of it)
+	ceiling = snapclient->jitter_ceiling;
+	heap = (int64_t) heap_caps_get_free_size(MALLOC_CAP_8BIT) + jb->bytes - SNAPCLIENT_STREAM_HEAP_RESERVE;
+	if (heap < ceiling) {
+		ceiling = heap > 0 ? heap : 0;
+	}
+	if (bytes > ceiling) {
+		ESP_LOGW(TAG, "%lld ms of audio need %lld bytes, limited to %lld",
+				 delay_ms, bytes, ceiling);
+		bytes = ceiling;
+	}
+
+	snapclient->sized_chunk_us = jb->chunk_us;
+	if (capacity == jb->capacity && (size_t) bytes == jb->max_bytes) {
+		return;
+	}
+	if (jitter_buffer_resize(jb, capacity, bytes)) {
+		ESP_LOGE(TAG, "Failed to resize the jitter buffer to %u chunks", (unsigned) capacity);
+		return;
+	}
+	ESP_LOGI(TAG, "Jitter buffer: %u chunks, %lld bytes for %lld ms",
+			 (unsigned) capacity, bytes, delay_ms);
+}
+
+// Play out delay from the server settings, or the recommended one
+static void _snapclient_apply_delay(snapclient_stream_t *snapclient)
+{
+	int64_t delay_us = ((int64_t) snapclient->server_settings_message.buffer_ms
+						- snapclient->server_settings_message.latency) * 1000;
+
+	if (snapclient->auto_latency && snapclient->recommended_ms) {
+		delay_us = (int64_t) snapclient->recommended_ms * 1000;
+	}
+	if (delay_us == snapclient->jitter_buffer.delay_us) {
+		return;
+	}
+
+	jitter_buffer_set_delay(&(snapclient->jitter_buffer), delay_us);
+	_snapclient_size_buffers(snapclient);
+	// line up again on the new schedule
+	if (snapclient->started) {
+		snapclient->started = false;
+		snapclient->fade_in = true;
+	}
+}
+
+/*
+ * Recommend the smallest delay keeping SNAPCLIENT_STREAM_TUNE_QUANTILE of
+ * the chunks on time: chunks must arrive before being released, which is
+ * the downstream latency ahead of their play time, and a poll period may
+ * pass before they are.
+ *
+ * Each change lines playback up again, so the delay only moves by
+ * SNAPCLIENT_STREAM_TUNE_MIN_CHANGE_MS at least: up at once since chunks are
+ * being lost, down once SNAPCLIENT_STREAM_TUNE_LOWER_WINDOWS recommendations
+ * in a row agree, to the highest of them.
+ */
+static void _snapclient_tune(audio_element_handle_t self, snapclient_stream_t *snapclient)
+{
+	snapclient_stream_latency_t latency = { 0 };
+	int64_t lateness_us, recommended_us;
+	int32_t current_ms;
+
+	lateness_us = latency_histogram_quantile(&(snapclient->lateness), SNAPCLIENT_STREAM_TUNE_QUANTILE);
+	recommended_us = lateness_us
+		+ _snapclient_play_now_us(snapclient)
+		- time_sync_server_time(&(snapclient->time_sync), snapclient_clock_now_us())
+		+ (SNAPCLIENT_STREAM_POLL_MS + SNAPCLIENT_STREAM_TUNE_MARGIN_MS) * 1000;
+	latency.buffer_ms = (recommended_us / 1000 + SNAPCLIENT_STREAM_TUNE_STEP_MS - 1)
+		/ SNAPCLIENT_STREAM_TUNE_STEP_MS * SNAPCLIENT_STREAM_TUNE_STEP_MS;
+
+	current_ms = snapclient->recommended_ms ? snapclient->recommended_ms
+		: snapclient->server_settings_message.buffer_ms - snapclient->server_settings_message.latency;
+	if (latency.buffer_ms > current_ms - SNAPCLIENT_STREAM_TUNE_MIN_CHANGE_MS
+		&& latency.buffer_ms < current_ms + SNAPCLIENT_STREAM_TUNE_MIN_CHANGE_MS) {
+		snapclient->tune_lower = 0;
+		return;
+	}
+	if (latency.buffer_ms < current_ms) {
+		if (!snapclient->tune_lower++ || latency.buffer_ms > snapclient->tune_lower_ms) {
+			snapclient->tune_lower_ms = latency.buffer_ms;
+		}
+		if (snapclient->tune_lower < SNAPCLIENT_STREAM_TUNE_LOWER_WINDOWS) {
+			return;
+		}
+		latency.buffer_ms = snapclient->tune_lower_ms;
+	}
+	snapclient->tune_lower = 0;
+	snapclient->recommended_ms = latency.buffer_ms;
+
+	latency.latency_ms = snapclient->server_settings_message.buffer_ms - latency.buffer_ms;
+	latency.lateness_ms = lateness_us / 1000;
+	latency.max_ms = snapclient->lateness.max_us / 1000;
+	latency.chunks = snapclient->lateness.count;
+	if (snapclient->auto_latency) {
+		_snapclient_apply_delay(snapclient);
+		latency.applied = true;
+	}
+
+	ESP_LOGI(TAG, "Recommended delay %d ms (latency %d ms), %d ms lateness, %d ms max",
+			 latency.buffer_ms, latency.latency_ms, latency.lateness_ms, latency.max_ms);
+	_dispatch_event(self, snapclient, &latency, sizeof(latency), SNAPCLIENT_STREAM_STATE_LATENCY);
+}
+
+static void _snapclient_count_late(snapclient_stream_t *snapclient, size_t chunks, int64_t duration_us)
+{
+	snapclient->stats.late_chunks += chunks;
+	snapclient->late_us += duration_us;
+	snapclient->stats.late_ms = snapclient->late_us / 1000;
+}
+
+/*
+ * How long the last buffered chunk, due now, may wait for the next one
+ * before the downstream ring buffers run dry. Holding it does not delay
+ * it: it still plays right after what is queued. Without the downstream
+ * latency it cannot be held.
+ */
+static int64_t _snapclient_hold_us(snapclient_stream_t *snapclient)
+{
+	playout_level_t level;
+
+	if (!snapclient->downstream || !snapclient->sample_format.rate) {
+		return 0;
+	}
+	_snapclient_playout_level(snapclient, &level);
+	return playout_hold_us(&level,
+						   (int64_t) SNAPCLIENT_STREAM_FADE_FRAMES * 1000000 / snapclient->sample_format.rate
+						   + _snapclient_decode_ahead_us(snapclient),
+						   SNAPCLIENT_STREAM_POLL_MS * 1000);
+}
+
+/*
+ * Output the chunks whose play time has come on the server clock, early
+ * by the downstream latency. Nothing is released before the first time
+ * exchange since there is no play time yet.
+ *
+ * The last chunk buffered is held while the downstream buffers can wait
+ * for the next one. If that does not come in time, the stream is about to
+ * run dry: the chunk tail is faded out and the next chunk, whenever it
+ * comes, is lined up on the schedule again.
+ */
+static void _snapclient_release(audio_element_handle_t self, snapclient_stream_t *snapclient)
+{
+	jitter_buffer_t *jb = &(snapclient->jitter_buffer);
+	jitter_buffer_entry_t *entry;
+	int64_t now_us, dropped_us, hold_us;
+	size_t dropped;
+	bool last;
+
+	snapclient->hold_end_us = 0;
+	if (!time_sync_is_valid(&(snapclient->time_sync))) {
+		return;
+	}
+
+	now_us = _snapclient_play_now_us(snapclient);
+
+	// playing a backlog would only add delay against the other clients,
+	// skip to the chunk due now
+	dropped = jitter_buffer_drop_late(jb, now_us - snapclient->late_tolerance_us,
+									  snapclient->sample_format.rate, snapclient->frame_size,
+									  &dropped_us);
+	if (dropped) {
+		ESP_LOGW(TAG, "Dropped %u late chunks (%lld ms)", (unsigned) dropped, dropped_us / 1000);
+		_snapclient_count_late(snapclient, dropped, dropped_us);
+		if (snapclient->started) {
+			snapclient->started = false;
+			snapclient->fade_in = true;
+		}
+	}
+
+	if (!snapclient->started && !_snapclient_start(self, snapclient, now_us)) {
+		if (snapclient->playing) {
+			_snapclient_fill_gap(self, snapclient);
+		}
+		return;
+	}
+
+	// each released chunk queues more downstream, once decoded for
+	// compressed ones
+	for (; (entry = jitter_buffer_due(jb, now_us + _snapclient_decode_ahead_us(snapclient)));
+		 now_us = _snapclient_play_now_us(snapclient)) {
+		// the element was paused or stalled, start over on the schedule
+		if (now_us - jitter_buffer_play_time(jb, entry) > SNAPCLIENT_STREAM_RESYNC_MS * 1000) {
+			snapclient->started = false;
+			if (!_snapclient_start(self, snapclient, now_us)) {
+				return;
+			}
+			entry = jitter_buffer_peek(jb);
+		}
+
+		last = jb->count == 1;
+		if (last && (hold_us = _snapclient_hold_us(snapclient)) > 0) {
+			snapclient->hold_end_us = snapclient_clock_now_us() + hold_us;
+			return;
+		}
+
+		_snapclient_measure_decode(snapclient, now_us);
+		if (!snapclient->frame_size) {
+			snapclient->released_end_us = jitter_buffer_play_time(jb, entry) + jb->chunk_us;
+		}
+		_snapclient_output_chunk(self, snapclient, entry, snapclient->fade_in, last);
+		snapclient->fade_in = false;
+		if (last) {
+			snapclient->started = false;
+			snapclient->in_gap = true;
+			snapclient->gap_start_us = jitter_buffer_play_time(jb, entry);
+			if (snapclient->frame_size) {
+				snapclient->gap_start_us += (int64_t) entry->chunk.size / snapclient->frame_size
+					* 1000000 / snapclient->sample_format.rate;
+			}
+		}
+		jitter_buffer_pop(jb);
+	}
+}
+
+// How long a read may wait without delaying the next release
+static int _snapclient_wait_ms(snapclient_stream_t *snapclient)
+{
+	jitter_buffer_entry_t *entry = jitter_buffer_peek(&(snapclient->jitter_buffer));
+	int64_t wait_us;
+
+	if (!entry) {
+		// keep filling a gap with silence
+		return snapclient->playing ? SNAPCLIENT_STREAM_POLL_MS : snapclient->timeout_ms;
+	}
+	if (!time_sync_is_valid(&(snapclient->time_sync))) {
+		return SNAPCLIENT_STREAM_POLL_MS;
+	}
+
+	wait_us = jitter_buffer_play_time(&(snapclient->jitter_buffer), entry)
+		- _snapclient_play_now_us(snapclient);
+	if (!snapclient->started) {
+		wait_us -= _snapclient_start_lead_us(snapclient);
+		// compressed starts go through the decoder, see _snapclient_start()
+		if (!snapclient->frame_size) {
+			wait_us -= snapclient->decode_latency_us;
+		}
+	} else {
+		wait_us -= _snapclient_decode_ahead_us(snapclient);
+	}
+	// a held chunk waits for the next one, which ends the read early
+	if (wait_us <= 0 && snapclient->hold_end_us) {
+		wait_us = snapclient->hold_end_us - snapclient_clock_now_us();
+	}
+	if (wait_us <= 0) {
+		return 0;
+	}
+	if (wait_us >= SNAPCLIENT_STREAM_POLL_MS * 1000) {
+		return SNAPCLIENT_STREAM_POLL_MS;
+	}
+	return (wait_us + 999) / 1000;
+}
+
+esp_err_t snapclient_stream_get_stats(audio_element_handle_t el, snapclient_stream_stats_t *stats)
+{
+	snapclient_stream_t *snapclient = (snapclient_stream_t *)audio_element_getdata(el);
+	AUDIO_NULL_CHECK(TAG, snapclient, return ESP_FAIL);
+
+	*stats = snapclient->stats;
+	return ESP_OK;
+}
+
 static esp_err_t _snapclient_open(audio_element_handle_t self)
 {
     AUDIO_NULL_CHECK(TAG, self, return ESP_FAIL);
-	int result;
-    struct timeval now;
 	ESP_LOGI(TAG, "OPENING Snapclient stream");
 
     snapclient = (snapclient_stream_t *)audio_element_getdata(self);
@@ -148,19 +864,38 @@ static esp_err_t _snapclient_open(audio_element_handle_t self)
         return ESP_FAIL;
     }
 
+    xSemaphoreTake(snapclient->write_lock, portMAX_DELAY);
+    xSemaphoreTake(snapclient->sync_lock, portMAX_DELAY);
     snapclient->is_open = true;
     snapclient->t = t;
+	snapclient->time_message.latency.sec = 0;
+	snapclient->time_message.latency.usec = 0;
+    xSemaphoreGive(snapclient->sync_lock);
+    xSemaphoreGive(snapclient->write_lock);
 	snapclient->base_message.type = SNAPCAST_MESSAGE_BASE;  // default state, no current message
+	framer_reset(&(snapclient->framer));
+	stream_tags_message_init(&(snapclient->stream_tags_message));
+	time_sync_init(&(snapclient->time_sync));
+	jitter_buffer_clear(&(snapclient->jitter_buffer));
+	snapclient->started = false;
+	snapclient->playing = false;
+	snapclient->in_gap = false;
+	snapclient->fade_in = false;
+	snapclient->read_us = snapclient_clock_now_us();
+	sync_scheduler_init(&(snapclient->sync_scheduler));
+	latency_histogram_init(&(snapclient->lateness));
+	snapclient->tune_chunks = 0;
+	snapclient->recommended_ms = 0;
+	snapclient->tune_lower = 0;
+	snapclient->sized_chunk_bytes = 0;
+	_snapclient_reset_decode(snapclient);
 	snapclient->base_message.sent.sec = 0;
 	snapclient->base_message.sent.usec = 0;
 	snapclient->base_message.received.sec = 0;
 	snapclient->base_message.received.usec = 0;
 	snapclient->received_header = false;
-	snapclient->last_sync.tv_sec = 0;
-	snapclient->last_sync.tv_usec = 0;
+	snapclient->last_sync_us = 0;
 	snapclient->id_counter = 0;
-	snapclient->time_message.latency.sec = 0;
-	snapclient->time_message.latency.usec = 0;
 
 
 	char mac_address[18];
@@ -171,21 +906,6 @@ static esp_err_t _snapclient_open(audio_element_handle_t self)
 			"%02X:%02X:%02X:%02X:%02X:%02X",
 			base_mac[0], base_mac[1], base_mac[2], base_mac[3], base_mac[4], base_mac[5]);
 
-	result = gettimeofday(&now, NULL);
-	if (result) {
-		ESP_LOGI(TAG, "Failed to gettimeofday\r\n");
-		return ESP_FAIL;
-	}
-
-	base_message_t base_message = {
-		SNAPCAST_MESSAGE_HELLO,      // type
-		0x0,                         // id
-		0x0,                         // refersTo
-		{ now.tv_sec, now.tv_usec }, // sent
-		{ 0x0, 0x0 },                // received
-		0x0,                         // size
-	};
-
 	hello_message_t hello_message = {
 		mac_address,
 		SNAPCLIENT_STREAM_CLIENT_NAME,  // hostname
@@ -198,58 +918,32 @@ static esp_err_t _snapclient_open(audio_element_handle_t self)
 		2,                     // protocol version
 	};
 
-    char base_message_serialized[BASE_MESSAGE_SIZE];
-    char *hello_message_serialized;
+	snapclient_outbound_t outbound = { .type = SNAPCAST_MESSAGE_HELLO, .payload = snapclient->hello_payload };
+	write_buffer_t buffer;
 
-	// serialize the hello message putting the computed size in
-	// base_messge.size
-	hello_message_serialized = hello_message_serialize(
-		&hello_message, (size_t*) &(base_message.size));
-	if (!hello_message_serialized) {
+	// drop whatever was left from a previous connection, no Hello still
+	// refers to the payload
+	xQueueReset(snapclient->out_queue);
+	buffer_write_init(&buffer, snapclient->hello_payload, sizeof(snapclient->hello_payload));
+	if (hello_message_serialize(&hello_message, &buffer)) {
 		ESP_LOGI(TAG, "Failed to serialize hello message\r\b");
 		return ESP_FAIL;
 	}
+	outbound.size = buffer.index;
 
-	result = base_message_serialize(
-		&base_message,
-		base_message_serialized,
-		BASE_MESSAGE_SIZE);
-
-	if (result) {
-		ESP_LOGI(TAG, "Failed to serialize base message\r\n");
-        return ESP_FAIL;
+	if (_snapclient_queue(snapclient, &outbound) != ESP_OK) {
+		return ESP_FAIL;
 	}
 
-	result = esp_transport_write(snapclient->t,
-								 base_message_serialized, BASE_MESSAGE_SIZE,
-								 snapclient->timeout_ms);
-    if (result < 0) {
-        _get_socket_error_code_reason("TCP write", snapclient->sock);
-        goto _snapclient_open_exit;
-    }
-	result = esp_transport_write(snapclient->t,
-								 hello_message_serialized, base_message.size,
-								 snapclient->timeout_ms);
-    if (result < 0) {
-        _get_socket_error_code_reason("TCP write", snapclient->sock);
-        goto _snapclient_open_exit;
-    }
-	free(hello_message_serialized);
-
-	// start the one second timer that sends Time messages
-	send_time_tm_handle = xTimerCreate(
-		"snapclient_timer0", 1000 / portTICK_RATE_MS,
-		pdTRUE, NULL, send_time_timer_cb);
-	xTimerStart(send_time_tm_handle, 0);
+	// start the Time requests burst, the timer is then rearmed by the
+	// writer with the scheduler delays
+	xTimerChangePeriod(snapclient->sync_timer,
+					   sync_scheduler_next_ms(&(snapclient->sync_scheduler)) / portTICK_RATE_MS, 0);
 
     _dispatch_event(self, snapclient, NULL, 0, SNAPCLIENT_STREAM_STATE_CONNECTED);
 	ESP_LOGI(TAG, "snapclient_stream_open OK");
 
     return ESP_OK;
-
-_snapclient_open_exit:
-    free(hello_message_serialized);
-    return ESP_FAIL;
 }
 
 static esp_err_t _snapclient_close(audio_element_handle_t self)
@@ -260,15 +954,23 @@ static esp_err_t _snapclient_close(audio_element_handle_t self)
 
     snapclient_stream_t *snapclient = (snapclient_stream_t *)audio_element_getdata(self);
     AUDIO_NULL_CHECK(TAG, snapclient, return ESP_FAIL);
+    int result;
     if (!snapclient->is_open) {
         ESP_LOGE(TAG, "Already closed");
         return ESP_FAIL;
     }
-    if (-1 == esp_transport_close(snapclient->t)) {
+    xTimerStop(snapclient->sync_timer, 0);
+    // wait for a write in progress to complete
+    xSemaphoreTake(snapclient->write_lock, portMAX_DELAY);
+    xSemaphoreTake(snapclient->sync_lock, portMAX_DELAY);
+    snapclient->is_open = false;
+    xSemaphoreGive(snapclient->sync_lock);
+    result = esp_transport_close(snapclient->t);
+    xSemaphoreGive(snapclient->write_lock);
+    if (-1 == result) {
         ESP_LOGE(TAG, "Snapclient stream close failed");
         return ESP_FAIL;
     }
-    snapclient->is_open = false;
     if (AEL_STATE_PAUSED != audio_element_get_state(self)) {
         audio_element_set_byte_pos(self, 0);
     }
@@ -278,112 +980,101 @@ static esp_err_t _snapclient_close(audio_element_handle_t self)
 static esp_err_t _snapclient_read(audio_element_handle_t self, char *buffer, int len, TickType_t ticks_to_wait, void *context)
 {
     snapclient_stream_t *snapclient = (snapclient_stream_t *)audio_element_getdata(self);
-	char *buff = buffer;
-	int rem = len;
-	int rlen;
-	int loop = 0;
-	while (rem > 0)
-	{
-		rlen = esp_transport_read(snapclient->t, buff, rem, snapclient->timeout_ms);
-
-		if (rlen < 0) {
-			ESP_LOGE(TAG, "Error reading th TCP socket");
-			_get_socket_error_code_reason("TCP read", snapclient->sock);
-			return ESP_FAIL;
-		} else if (rlen == 0) {
-			ESP_LOGI(TAG, "Get end of the file");
-			break;
+	int rlen, wait_ms;
+
+	// Only wait for data until the next chunk is due, process() releases it
+	// on timeouts
+	wait_ms = _snapclient_wait_ms(snapclient);
+	if (wait_ms == 0) {
+		return AEL_IO_TIMEOUT;
+	}
+	rlen = esp_transport_poll_read(snapclient->t, wait_ms);
+	if (rlen == 0) {
+		// the scheduler keeps running on short waits, the connection is
+		// only given up after timeout_ms without data
+		if (snapclient_clock_now_us() - snapclient->read_us > (int64_t) snapclient->timeout_ms * 1000) {
+			ESP_LOGE(TAG, "No data for %d ms", snapclient->timeout_ms);
+			return AEL_IO_DONE;
 		}
+		return AEL_IO_TIMEOUT;
+	} else if (rlen < 0) {
+		ESP_LOGE(TAG, "Error polling th TCP socket");
+		_get_socket_error_code_reason("TCP poll", snapclient->sock);
+		return ESP_FAIL;
+	}
 
-		buff += rlen;
-		rem -= rlen;
-		loop += 1;
+	// Return whatever the socket has to offer: the framer copes with
+	// messages split across reads, so there is no need to wait for a full
+	// buffer here.
+	rlen = esp_transport_read(snapclient->t, buffer, len, snapclient->timeout_ms);
+	// Stamp the bytes here rather than when they are parsed, the time spent
+	// in between would otherwise add to the s2c latency of Time messages
+	snapclient->read_us = snapclient_clock_now_us();
+	if (rlen < 0) {
+		ESP_LOGE(TAG, "Error reading th TCP socket");
+		_get_socket_error_code_reason("TCP read", snapclient->sock);
+		return ESP_FAIL;
+	} else if (rlen == 0) {
+		ESP_LOGI(TAG, "Get end of the file");
+		return AEL_IO_DONE;
 	}
 
-    // ESP_LOGI(TAG, "read len=%d, loops=%d", len, loop);
-    if (rem > 0) {
-        ESP_LOGI(TAG, "Could not read the whole buffer!");
-    }
-	audio_element_update_byte_pos(self, len);
-    return len;
+	audio_element_update_byte_pos(self, rlen);
+    return rlen;
 }
 
 static esp_err_t _snapclient_process(audio_element_handle_t self, char *in_buffer, int in_len)
 {
-    struct timeval now, tv1, tv3; //, last_time_sync;
 	int result;
     int r_size;
-    int w_size = 0;
-	int size;
 	int message_size;
-	char *start;
+	const char *payload;
+	message_frame_t frame;
 
 	// ESP_LOGI(TAG, "Process: %d available bytes", in_len);
 
 	snapclient_stream_t *snapclient = (snapclient_stream_t *)audio_element_getdata(self);
 
+	r_size = audio_element_input(self, in_buffer, in_len);
+	if (r_size == AEL_IO_TIMEOUT) {
+		_snapclient_release(self, snapclient);
+		return AEL_IO_TIMEOUT;
+	}
+	if (r_size <= 0) {
+		return r_size;
+	}
 
-	start = in_buffer;
-
-	while(true) {
-
-		if (snapclient->base_message.type == SNAPCAST_MESSAGE_BASE)
-			message_size = BASE_MESSAGE_SIZE;
-		else
-			message_size = snapclient->base_message.size;
+	// the element has no input ring buffer, audio_element_input() just
+	// called _snapclient_read() so these are the bytes it stamped
+	framer_feed(&(snapclient->framer), in_buffer, r_size, snapclient->read_us);
 
-		if (in_len < message_size) {
-			// not enough data available, exit this loop
-			//ESP_LOGD(TAG, "Not enought data left for message %d: %d/%d",
-			//		 snapclient->base_message.type, in_len, message_size);
+	while (true) {
+		result = framer_next(&(snapclient->framer), &frame);
+		if (result == 1) {
+			// the whole fragment has been consumed
 			break;
 		}
-		r_size = audio_element_input(self, in_buffer, message_size);
-		if (r_size <= 0) {
-			// ring buffer cannot provide enough data (weird...)
-			ESP_LOGI(TAG, "Cannot retrieved %d bytes of data!!!", message_size);
-			break;
-		}
-		in_len -= r_size;
-		if (r_size < message_size)  // XXX
-		{
-			ESP_LOGE(TAG, "Retrieved only %d bytes of data instead of %d (on %d)!!! ABORT", r_size, message_size, in_len);
-			snapclient->base_message.type = SNAPCAST_MESSAGE_BASE;
-			break;
-			//return ESP_FAIL;
+		if (result == 2) {
+			ESP_LOGE(TAG, "Message type %d too large (%d bytes), dropped",
+					 frame.base.type, frame.base.size);
+			continue;
 		}
 
+		snapclient->base_message = frame.base;
+		snapclient->base_message.received = tv_from_us(frame.received_us);
+		message_size = frame.base.size;
+		payload = frame.payload;
+
 		// ESP_LOGW(TAG, "LOOP type=%d message_size=%d r_size=%d",
 		//		 snapclient->base_message.type, message_size, r_size);
 
 		switch (snapclient->base_message.type) {
-			case SNAPCAST_MESSAGE_BASE:
-				//ESP_LOGI(TAG, "SNAPCAST_MESSAGE_BASE (size=%d/%d)", message_size, r_size);
-				// it's a new message
-				// let's get this message
-				result = gettimeofday(&now, NULL);
-				if (result) {
-					ESP_LOGI(TAG, "Failed to gettimeofday\r\n");
-					break; //return ESP_FAIL;
-				}
-				result = base_message_deserialize(
-					&(snapclient->base_message), in_buffer, BASE_MESSAGE_SIZE);
-				if (result) {
-					ESP_LOGI(TAG, "Failed to read base message: %d\r\n", result);
-					break; //return ESP_FAIL;
-				}
-				snapclient->base_message.received.sec = now.tv_sec;
-				snapclient->base_message.received.usec = now.tv_usec;
-
-				break;
-
 			case SNAPCAST_MESSAGE_CODEC_HEADER:
 				ESP_LOGI(TAG, "SNAPCAST_MESSAGE_CODEC_HEADER (size=%d/%d)", message_size, r_size);
-				snapclient->base_message.type = SNAPCAST_MESSAGE_BASE;
 
 				result = codec_header_message_deserialize(
 					&(snapclient->codec_header_message),
-					in_buffer, snapclient->base_message.size);
+					payload, message_size);
 
 				if (result) {
 					ESP_LOGI(TAG, "Failed to read codec header: %d\r\n", result);
@@ -393,10 +1084,9 @@ static esp_err_t _snapclient_process(audio_element_handle_t self, char *in_buffe
 				ESP_LOGI(TAG, "Received codec header message\r\n");
 
 				esp_codec_type_t codec;
-				size = snapclient->codec_header_message.size;
-				start = snapclient->codec_header_message.payload;
 				ESP_LOGI(TAG, "Codec: %s , Size: %d",
-						 snapclient->codec_header_message.codec, size);
+						 snapclient->codec_header_message.codec,
+						 snapclient->codec_header_message.size);
 				if (strcmp(snapclient->codec_header_message.codec, "opus") == 0) {
 					codec = ESP_CODEC_TYPE_OPUS;
 				} else if (strcmp(snapclient->codec_header_message.codec, "flac") == 0) {
@@ -410,28 +1100,52 @@ static esp_err_t _snapclient_process(audio_element_handle_t self, char *in_buffe
 					ESP_LOGI(TAG, "Codec : %s not supported",
 							 snapclient->codec_header_message.codec);
 					ESP_LOGI(TAG, "Change encoder codec to opus in /etc/snapserver.conf on server");
+					codec_header_message_free(&(snapclient->codec_header_message));
+					break;
+				}
+				// the sink takes whatever is released as pcm
+				if (codec != ESP_CODEC_TYPE_PCM && !snapclient->decoder) {
+					ESP_LOGE(TAG, "Codec : %s needs a decoder, none in the pipeline",
+							 snapclient->codec_header_message.codec);
+					ESP_LOGE(TAG, "Change encoder codec to pcm in /etc/snapserver.conf on server");
+					codec_header_message_free(&(snapclient->codec_header_message));
+					snapclient->received_header = false;
+					jitter_buffer_clear(&(snapclient->jitter_buffer));
 					break;
 				}
-				audio_element_set_codec_fmt(self, codec);
 
-				uint32_t rate;
-				memcpy(&rate, start+4, sizeof(rate));
-				uint16_t bits;
-				memcpy(&bits, start+8, sizeof(bits));
-				uint16_t channels;
-				memcpy(&channels, start+10, sizeof(channels));
-				ESP_LOGI(TAG, "sampleformat: %d:%d:%d\n", rate, bits, channels);
+				result = codec_header_message_sample_format(
+					&(snapclient->codec_header_message),
+					&(snapclient->sample_format));
+				if (result) {
+					ESP_LOGE(TAG, "Failed to read sample format from %s codec header",
+							 snapclient->codec_header_message.codec);
+					codec_header_message_free(&(snapclient->codec_header_message));
+					break;
+				}
+				codec_header_message_free(&(snapclient->codec_header_message));
+				ESP_LOGI(TAG, "sampleformat: %d:%d:%d\n", snapclient->sample_format.rate,
+						 snapclient->sample_format.bits, snapclient->sample_format.channels);
 
+				snapclient->frame_size = codec == ESP_CODEC_TYPE_PCM ?
+					snapclient->sample_format.bits / 8 * snapclient->sample_format.channels : 0;
+				audio_element_set_codec_fmt(self, codec);
 				snapclient->received_header = true;
-				codec_header_message_free(&(snapclient->codec_header_message));
+				// a new stream starts over from its first chunk
+				jitter_buffer_clear(&(snapclient->jitter_buffer));
+				snapclient->sized_chunk_bytes = 0;
+				_snapclient_reset_decode(snapclient);
+				_snapclient_size_buffers(snapclient);
+				snapclient->started = false;
+				snapclient->playing = false;
+				snapclient->in_gap = false;
 
-				break;
 				// notify the codec infos
 				audio_element_info_t snap_info = {0};
 				audio_element_getinfo(self, &snap_info);
-				snap_info.sample_rates = rate;
-				snap_info.bits = bits;
-				snap_info.channels = channels;
+				snap_info.sample_rates = snapclient->sample_format.rate;
+				snap_info.bits = snapclient->sample_format.bits;
+				snap_info.channels = snapclient->sample_format.channels;
 				audio_element_setinfo(self, &snap_info);
 				audio_element_report_info(self);
 
@@ -439,7 +1153,6 @@ static esp_err_t _snapclient_process(audio_element_handle_t self, char *in_buffe
 
 			case SNAPCAST_MESSAGE_WIRE_CHUNK:
 				//ESP_LOGI(TAG, "SNAPCAST_MESSAGE_WIRE_CHUNK (size=%d/%d)", message_size, r_size);
-				snapclient->base_message.type = SNAPCAST_MESSAGE_BASE;
 
 				if (!snapclient->received_header) {
 					ESP_LOGI(TAG, "NO HEADER, ignoring");
@@ -448,52 +1161,81 @@ static esp_err_t _snapclient_process(audio_element_handle_t self, char *in_buffe
 
 				result = wire_chunk_message_deserialize(
 					&(snapclient->wire_chunk_message),
-					in_buffer, message_size);
+					payload, message_size);
 
 				if (result) {
 					ESP_LOGI(TAG, "Failed to read chunk message: %d", result);
-					if (result == 2)  // malloc failed, cannot recover from this I guess...
-						return ESP_FAIL;
-					else
-						break;
+					break;
 				}
-				//ESP_LOGI(TAG, "Received wire message\r\n");
-				size = snapclient->wire_chunk_message.size;
-				start = (snapclient->wire_chunk_message.payload);
-				//ESP_LOGI(TAG, "size : %d\n", size);
 
-				// write the received chunk in the output ring buffer
-				w_size = audio_element_output(self, start, size);
-				if (w_size > 0) {
-					//ESP_LOGI(TAG, "Inserted %d of data stream", w_size);
+				// late chunks count too, they are what the recommendation
+				// is about
+				if (time_sync_is_valid(&(snapclient->time_sync))) {
+					latency_histogram_add(&(snapclient->lateness),
+						time_sync_server_time(&(snapclient->time_sync), frame.received_us)
+						- tv_to_us(snapclient->wire_chunk_message.timestamp));
+					if (++snapclient->tune_chunks == SNAPCLIENT_STREAM_TUNE_CHUNKS) {
+						snapclient->tune_chunks = 0;
+						_snapclient_tune(self, snapclient);
+					}
+				}
 
-					audio_element_update_byte_pos(self, size);
+				// do not even copy chunks that are already too late
+				if (time_sync_is_valid(&(snapclient->time_sync))
+					&& tv_to_us(snapclient->wire_chunk_message.timestamp)
+					   + snapclient->jitter_buffer.delay_us
+					   < _snapclient_play_now_us(snapclient) - snapclient->late_tolerance_us) {
+					_snapclient_count_late(snapclient, 1, snapclient->frame_size ?
+						(int64_t) (snapclient->wire_chunk_message.size / snapclient->frame_size)
+						* 1000000 / snapclient->sample_format.rate
+						: snapclient->jitter_buffer.chunk_us);
+					wire_chunk_message_free(&(snapclient->wire_chunk_message));
+					break;
 				}
-				else
-					ESP_LOGI(TAG, "Not Inserted any data stream");
 
-				//free(snapclient->wire_chunk_message.payload);
+				// grow with the compressed chunks, with some room for the
+				// next ones of a variable bitrate
+				if (!snapclient->frame_size
+					&& snapclient->wire_chunk_message.size > snapclient->sized_chunk_bytes) {
+					snapclient->sized_chunk_bytes = snapclient->wire_chunk_message.size
+						+ snapclient->wire_chunk_message.size / SNAPCLIENT_STREAM_JITTER_MARGIN;
+					_snapclient_size_buffers(snapclient);
+				}
+
+				// the payload is borrowed from the framer, the jitter buffer
+				// keeps a copy until the chunk is due
+				result = jitter_buffer_push(&(snapclient->jitter_buffer),
+											&(snapclient->wire_chunk_message));
+				if (result) {
+					ESP_LOGW(TAG, "Chunk dropped: %d", result);
+					wire_chunk_message_free(&(snapclient->wire_chunk_message));
+				}
+				if (snapclient->jitter_buffer.chunk_us != snapclient->sized_chunk_us) {
+					_snapclient_size_buffers(snapclient);
+				}
+				if (snapclient->jitter_buffer.stats.overflows != snapclient->overflows) {
+					ESP_LOGW(TAG, "Jitter buffer full, %u chunks dropped",
+							 snapclient->jitter_buffer.stats.overflows - snapclient->overflows);
+					snapclient->stats.overflows += snapclient->jitter_buffer.stats.overflows - snapclient->overflows;
+					snapclient->overflows = snapclient->jitter_buffer.stats.overflows;
+				}
 				break;
 
 			case SNAPCAST_MESSAGE_SERVER_SETTINGS:
 				ESP_LOGI(TAG, "SNAPCAST_MESSAGE_SERVER_SETTINGS (size=%d/%d)", message_size, r_size);
-				snapclient->base_message.type = SNAPCAST_MESSAGE_BASE;
 
-				// The first 4 bytes in the buffer are the size of the string.
-				// We don't need this, so we'll shift the entire buffer over 4 bytes
-				// and use the extra room to add a null character so cJSON can parse it.
-				memmove(in_buffer, in_buffer + 4, message_size - 4);
-				in_buffer[message_size - 3] = '\0';
 				result = server_settings_message_deserialize(
-					&(snapclient->server_settings_message), in_buffer);
+					&(snapclient->server_settings_message), payload, message_size);
 				if (result) {
 					ESP_LOGI(TAG, "Failed to read server settings: %d\r\n", result);
 					break;
 				}
+				// chunks play bufferMs after their timestamp, minus the
+				// latency configured for this client
+				_snapclient_apply_delay(snapclient);
+
 				// log mute state, buffer, latency
-				uint32_t buffer_ms = snapclient->server_settings_message.buffer_ms;
 				ESP_LOGI(TAG, "Buffer length:  %d", snapclient->server_settings_message.buffer_ms);
-				ESP_LOGI(TAG, "Ringbuffer size:%d", snapclient->server_settings_message.buffer_ms*48*4);
 				ESP_LOGI(TAG, "Latency:        %d", snapclient->server_settings_message.latency);
 				ESP_LOGI(TAG, "Mute:           %d", snapclient->server_settings_message.muted);
 				ESP_LOGI(TAG, "Setting volume: %d", snapclient->server_settings_message.volume);
@@ -541,59 +1283,90 @@ static esp_err_t _snapclient_process(audio_element_handle_t self, char *in_buffe
 
 				*/
 				ESP_LOGD(TAG, "SNAPCAST_MESSAGE_TIME (size=%d/%d)", message_size, r_size);
-				snapclient->base_message.type = SNAPCAST_MESSAGE_BASE;
+				// the writer sends it back in the next requests
+				xSemaphoreTake(snapclient->sync_lock, portMAX_DELAY);
 				result = time_message_deserialize(&(snapclient->time_message),
-												  in_buffer, message_size);
+												  payload, message_size);
+				xSemaphoreGive(snapclient->sync_lock);
 				if (result) {
 					ESP_LOGI(TAG, "Failed to deserialize time message\r\n");
 					break;
 				}
-				/*
-				ESP_LOGI(TAG, "BaseTX     : %d %d ", snapclient->base_message.sent.sec , snapclient->base_message.sent.usec);
-				ESP_LOGI(TAG, "BaseRX     : %d %d ", snapclient->base_message.received.sec , snapclient->base_message.received.usec);
-				ESP_LOGI(TAG, "baseTX->RX : %d s ", (snapclient->base_message.received.sec - snapclient->base_message.sent.sec);
-				ESP_LOGI(TAG, "baseTX->RX : %d ms ", (snapclient->base_message.received.usec - snapclient->base_message.sent.usec)/1000);
-				ESP_LOGI(TAG, "Latency : %d.%d ", snapclient->time_message.latency.sec,  snapclient->time_message.latency.usec/1000);
-				*/
 
-				// tv == server to client latency (s2c)
-				// time_message.latency == client to server latency(c2s)
-				// TODO the fact that I have to do this simple conversion means
-				// I should probably use the timeval struct instead of my own
-				struct timeval s2c, c2s;
-				tv1.tv_sec = snapclient->base_message.received.sec;
-				tv1.tv_usec = snapclient->base_message.received.usec;
-				tv3.tv_sec = snapclient->base_message.sent.sec;
-				tv3.tv_usec = snapclient->base_message.sent.usec;
-				//
-				timersub(&tv1, &tv3, &s2c);
-				c2s.tv_sec = snapclient->time_message.latency.sec;
-				c2s.tv_usec = snapclient->time_message.latency.usec;
-
-				// Note: server sends timestamps as seconds since boot, not epoch
-				/*
-				ESP_LOGI(TAG, "c2s: %ld %ld", c2s.tv_sec, c2s.tv_usec);
-				ESP_LOGI(TAG, "s2c: %ld %ld", s2c.tv_sec, s2c.tv_usec);
-				double time_diff = (
-					(((double)(c2s.tv_sec - s2c.tv_sec) / 2) * 1000) +
-					(((double)(c2s.tv_usec - s2c.tv_usec) / 2) / 1000));
-				ESP_LOGI(TAG, "Time diff: %.2fms", time_diff);
-				*/
+				// Note: server sends timestamps from its steady clock, not epoch;
+				// only differences with the same side's timestamps matter
+				int64_t s2c_us = tv_to_us(snapclient->base_message.received)
+					- tv_to_us(snapclient->base_message.sent);
+				int64_t c2s_us = tv_to_us(snapclient->time_message.latency);
+
+				int64_t received_us = tv_to_us(snapclient->base_message.received);
+				// how far the sample is from what the estimate predicted
+				int64_t residual_us = (c2s_us - s2c_us) / 2
+					- (time_sync_server_time(&(snapclient->time_sync), received_us) - received_us);
+				bool reliable = c2s_us + s2c_us <= snapclient->time_sync.rtt_us;
+
+				xSemaphoreTake(snapclient->sync_lock, portMAX_DELAY);
+				result = sync_scheduler_reply(&(snapclient->sync_scheduler),
+											  snapclient->base_message.refersTo,
+											  residual_us, reliable);
+				xSemaphoreGive(snapclient->sync_lock);
+
+				if (result < 0) {
+					ESP_LOGD(TAG, "Unexpected time reply to %d", snapclient->base_message.refersTo);
+					break;
+				}
+				if (result > 0) {
+					// the estimate lost track, do not wait for the long period
+					ESP_LOGI(TAG, "Time sync residual %lld us, speeding up", residual_us);
+					xTimerChangePeriod(snapclient->sync_timer,
+									   SYNC_SCHEDULER_MIN_INTERVAL_MS / portTICK_RATE_MS, 0);
+				}
+
+				if (time_sync_add(&(snapclient->time_sync), received_us, c2s_us, s2c_us)) {
+					ESP_LOGW(TAG, "Dropped time sample, c2s=%lld s2c=%lld",
+							 c2s_us, s2c_us);
+					break;
+				}
+				ESP_LOGD(TAG, "Time diff: %lld us (rtt <= %lld us), skew %.2f ppm",
+						 time_sync_server_time(&(snapclient->time_sync),
+											   tv_to_us(snapclient->base_message.received))
+						 - tv_to_us(snapclient->base_message.received),
+						 snapclient->time_sync.rtt_us,
+						 time_sync_skew_ppm(&(snapclient->time_sync)));
 				break;
 
 			case SNAPCAST_MESSAGE_STREAM_TAGS:
-				ESP_LOGI(TAG, "SNAPCAST_MESSAGE_STREAM_TAGS (size=%d/%d) [IGNORED]", message_size, r_size);
-				snapclient->base_message.type = SNAPCAST_MESSAGE_BASE;
+				ESP_LOGD(TAG, "SNAPCAST_MESSAGE_STREAM_TAGS (size=%d/%d)", message_size, r_size);
+				// tags are resent often, only parse them when they change
+				if (!stream_tags_message_changed(&(snapclient->stream_tags_message),
+												 payload, message_size)) {
+					break;
+				}
+				result = stream_tags_message_deserialize(
+					&(snapclient->stream_tags_message), &(snapclient->stream_tags_scratch),
+					payload, message_size);
+				if (result) {
+					ESP_LOGI(TAG, "Failed to read stream tags: %d\r\n", result);
+					break;
+				}
+				ESP_LOGI(TAG, "Now playing: %s - %s (%s)",
+						 snapclient->stream_tags_message.artist,
+						 snapclient->stream_tags_message.title,
+						 snapclient->stream_tags_message.album);
+				_dispatch_event(self, snapclient,
+								&(snapclient->stream_tags_message), sizeof(stream_tags_message_t),
+								SNAPCLIENT_STREAM_STATE_TAGS);
 				break;
 
 			default:
 				ESP_LOGI(TAG, "UNKNOWN_MESSAGE_TYPE %d (size=%d/%d)",
 						 snapclient->base_message.type, message_size, r_size);
-				snapclient->base_message.type = SNAPCAST_MESSAGE_BASE;
 				break;
 
 		} // switch
-	}  // while(r_size)
+	}  // while(framer_next)
+
+	_snapclient_release(self, snapclient);
 
 	//ESP_LOGI(TAG, "PROCESSING DONE");
 	return 1;  // Make sure we are not considered as closed
@@ -605,10 +1378,20 @@ static esp_err_t _snapclient_destroy(audio_element_handle_t self)
 
     snapclient_stream_t *snapclient = (snapclient_stream_t *)audio_element_getdata(self);
     AUDIO_NULL_CHECK(TAG, snapclient, return ESP_FAIL);
+    // nothing may queue or send anymore once the transport is gone
+    xTimerDelete(snapclient->sync_timer, portMAX_DELAY);
+    _snapclient_stop_writer(snapclient);
     if (snapclient->t) {
         esp_transport_destroy(snapclient->t);
         snapclient->t = NULL;
     }
+
+    vQueueDelete(snapclient->out_queue);
+    vSemaphoreDelete(snapclient->writer_done);
+    vSemaphoreDelete(snapclient->sync_lock);
+    vSemaphoreDelete(snapclient->write_lock);
+    jitter_buffer_deinit(&(snapclient->jitter_buffer));
+    audio_free(snapclient->frame_buffer);
     audio_free(snapclient);
     return ESP_OK;
 }
@@ -620,6 +1403,7 @@ audio_element_handle_t snapclient_stream_init(snapclient_stream_cfg_t *config)
 
 	audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
 	audio_element_handle_t el;
+	bool writer_started = false;
     cfg.open = _snapclient_open;
     cfg.close = _snapclient_close;
     cfg.process = _snapclient_process;
@@ -637,6 +1421,29 @@ audio_element_handle_t snapclient_stream_init(snapclient_stream_cfg_t *config)
 	snapclient_stream_t *snapclient = audio_calloc(1, sizeof(snapclient_stream_t));
     AUDIO_MEM_CHECK(TAG, snapclient, return NULL);
 
+	// messages split across reads are reassembled here
+	snapclient->frame_buffer = audio_calloc(1, SNAPCLIENT_STREAM_FRAME_BUF_SIZE);
+	AUDIO_MEM_CHECK(TAG, snapclient->frame_buffer, goto _snapclient_init_exit);
+	framer_init(&(snapclient->framer), snapclient->frame_buffer, SNAPCLIENT_STREAM_FRAME_BUF_SIZE);
+
+	if (jitter_buffer_init(&(snapclient->jitter_buffer), SNAPCLIENT_STREAM_JITTER_CHUNKS,
+						   config->jitter_buffer_size)) {
+		ESP_LOGE(TAG, "Failed to allocate the jitter buffer");
+		goto _snapclient_init_exit;
+	}
+	snapclient->sync_lock = xSemaphoreCreateMutex();
+	AUDIO_MEM_CHECK(TAG, snapclient->sync_lock, goto _snapclient_init_exit);
+	snapclient->write_lock = xSemaphoreCreateMutex();
+	AUDIO_MEM_CHECK(TAG, snapclient->write_lock, goto _snapclient_init_exit);
+	snapclient->writer_done = xSemaphoreCreateBinary();
+	AUDIO_MEM_CHECK(TAG, snapclient->writer_done, goto _snapclient_init_exit);
+	snapclient->out_queue = xQueueCreate(SNAPCLIENT_STREAM_OUT_QUEUE_LEN, sizeof(snapclient_outbound_t));
+	AUDIO_MEM_CHECK(TAG, snapclient->out_queue, goto _snapclient_init_exit);
+	snapclient->sync_timer = xTimerCreate("snapclient_sync",
+										  SYNC_SCHEDULER_BURST_INTERVAL_MS / portTICK_RATE_MS,
+										  pdFALSE, snapclient, send_time_timer_cb);
+	AUDIO_MEM_CHECK(TAG, snapclient->sync_timer, goto _snapclient_init_exit);
+
 	if (config->type == AUDIO_STREAM_READER) {
         cfg.read = _snapclient_read;
     } else if (config->type == AUDIO_STREAM_WRITER) {
@@ -647,6 +1454,11 @@ audio_element_handle_t snapclient_stream_init(snapclient_stream_cfg_t *config)
     snapclient->port = config->port;
     snapclient->host = config->host;
     snapclient->timeout_ms = config->timeout_ms;
+    snapclient->late_tolerance_us = (int64_t) config->late_tolerance_ms * 1000;
+    snapclient->jitter_ceiling = config->jitter_buffer_size;
+    snapclient->auto_latency = config->auto_latency;
+    snapclient->decoder = config->decoder;
+    snapclient->decode_ahead_max_us = (int64_t) config->decode_ahead_ms * 1000;
 
     if (config->event_handler) {
         snapclient->hook = config->event_handler;
@@ -655,6 +1467,14 @@ audio_element_handle_t snapclient_stream_init(snapclient_stream_cfg_t *config)
         }
     }
 
+    if (xTaskCreatePinnedToCore(_snapclient_writer_task, "snapclient_writer",
+                                SNAPCLIENT_STREAM_WRITER_STACK, snapclient,
+                                config->task_prio, NULL, config->task_core) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the writer task");
+        goto _snapclient_init_exit;
+    }
+    writer_started = true;
+
     el = audio_element_init(&cfg);
     AUDIO_MEM_CHECK(TAG, el, goto _snapclient_init_exit);
     audio_element_setdata(el, snapclient);
@@ -664,6 +1484,26 @@ audio_element_handle_t snapclient_stream_init(snapclient_stream_cfg_t *config)
     return el;
 
 _snapclient_init_exit:
+    if (writer_started) {
+        _snapclient_stop_writer(snapclient);
+    }
+    if (snapclient->sync_timer) {
+        xTimerDelete(snapclient->sync_timer, portMAX_DELAY);
+    }
+    if (snapclient->out_queue) {
+        vQueueDelete(snapclient->out_queue);
+    }
+    if (snapclient->writer_done) {
+        vSemaphoreDelete(snapclient->writer_done);
+    }
+    if (snapclient->sync_lock) {
+        vSemaphoreDelete(snapclient->sync_lock);
+    }
+    if (snapclient->write_lock) {
+        vSemaphoreDelete(snapclient->write_lock);
+    }
+    jitter_buffer_deinit(&(snapclient->jitter_buffer));
+    audio_free(snapclient->frame_buffer);
     audio_free(snapclient);
     return NULL;
 
@@ -0,0 +1,68 @@
+#include "sync_scheduler.h"
+
+#include <string.h>
+
+void sync_scheduler_init(sync_scheduler_t *scheduler) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->burst = SYNC_SCHEDULER_BURST;
+    scheduler->interval_ms = SYNC_SCHEDULER_MIN_INTERVAL_MS;
+}
+
+uint32_t sync_scheduler_next_ms(const sync_scheduler_t *scheduler) {
+    return scheduler->burst > 0 ? SYNC_SCHEDULER_BURST_INTERVAL_MS : scheduler->interval_ms;
+}
+
+uint32_t sync_scheduler_sent(sync_scheduler_t *scheduler, uint16_t id) {
+    scheduler->pending[scheduler->pending_next] = id;
+    scheduler->pending_valid[scheduler->pending_next] = true;
+    scheduler->pending_next = (scheduler->pending_next + 1) % SYNC_SCHEDULER_PENDING;
+    scheduler->requests++;
+
+    if (scheduler->burst > 0) {
+        scheduler->burst--;
+    }
+    return sync_scheduler_next_ms(scheduler);
+}
+
+int sync_scheduler_reply(sync_scheduler_t *scheduler, uint16_t refersTo,
+                         int64_t residual_us, bool reliable) {
+    size_t i;
+
+    for (i = 0; i < SYNC_SCHEDULER_PENDING; i++) {
+        if (scheduler->pending_valid[i] && scheduler->pending[i] == refersTo) {
+            break;
+        }
+    }
+    if (i == SYNC_SCHEDULER_PENDING) {
+        return -1;
+    }
+    scheduler->pending_valid[i] = false;
+
+    // Slow exchanges say more about the network than about the clocks
+    if (!reliable || scheduler->burst > 0) {
+        return 0;
+    }
+
+    if (residual_us > SYNC_SCHEDULER_MAX_RESIDUAL_US || residual_us < -SYNC_SCHEDULER_MAX_RESIDUAL_US) {
+        scheduler->stable = 0;
+        if (++scheduler->unstable < SYNC_SCHEDULER_UNSTABLE_REPLIES) {
+            return 0;
+        }
+
+        // Refill the window with fresh samples quickly
+        scheduler->unstable = 0;
+        scheduler->interval_ms = SYNC_SCHEDULER_MIN_INTERVAL_MS;
+        scheduler->burst = SYNC_SCHEDULER_BURST;
+        return 1;
+    }
+
+    scheduler->unstable = 0;
+    if (++scheduler->stable >= SYNC_SCHEDULER_STABLE_REPLIES) {
+        scheduler->stable = 0;
+        scheduler->interval_ms *= 2;
+        if (scheduler->interval_ms > SYNC_SCHEDULER_MAX_INTERVAL_MS) {
+            scheduler->interval_ms = SYNC_SCHEDULER_MAX_INTERVAL_MS;
+        }
+    }
+    return 0;
+}
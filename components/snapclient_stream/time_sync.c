@@ -0,0 +1,226 @@
+#include "time_sync.h"
+
+#include <string.h>
+
+void time_sync_init(time_sync_t *sync) {
+    memset(sync, 0, sizeof(*sync));
+}
+
+// Insertion sort, the window is small and mostly ordered from the last run
+static void time_sync_sort(int64_t *values, size_t count) {
+    size_t i, j;
+    int64_t value;
+
+    for (i = 1; i < count; i++) {
+        value = values[i];
+        for (j = i; j > 0 && values[j - 1] > value; j--) {
+            values[j] = values[j - 1];
+        }
+        values[j] = value;
+    }
+}
+
+static int64_t time_sync_median(const int64_t *values, size_t count) {
+    int64_t sorted[TIME_SYNC_WINDOW];
+
+    if (count == 0) {
+        return 0;
+    }
+    memcpy(sorted, values, count * sizeof(values[0]));
+    time_sync_sort(sorted, count);
+    return sorted[count / 2];
+}
+
+// Least squares fit of the offsets against the client time
+static void time_sync_fit(const int64_t *locals, const int64_t *offsets, size_t count,
+                            time_sync_estimate_t *estimate) {
+    int64_t local_sum = 0, offset_sum = 0, x, y;
+    double sxx = 0, sxy = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        local_sum += locals[i];
+        offset_sum += offsets[i];
+    }
+    estimate->local_us = local_sum / (int64_t) count;
+    estimate->offset_us = offset_sum / (int64_t) count;
+
+    for (i = 0; i < count; i++) {
+        x = locals[i] - estimate->local_us;
+        y = offsets[i] - estimate->offset_us;
+        sxx += (double) x * x;
+        sxy += (double) x * y;
+    }
+    estimate->skew = sxx > 0 ? sxy / sxx : 0;
+
+    if (estimate->skew > TIME_SYNC_MAX_SKEW_PPM / 1e6) {
+        estimate->skew = TIME_SYNC_MAX_SKEW_PPM / 1e6;
+    } else if (estimate->skew < -TIME_SYNC_MAX_SKEW_PPM / 1e6) {
+        estimate->skew = -TIME_SYNC_MAX_SKEW_PPM / 1e6;
+    }
+}
+
+static int64_t time_sync_predict(const time_sync_estimate_t *estimate, int64_t local_us) {
+    return estimate->offset_us + (int64_t) ((local_us - estimate->local_us) * estimate->skew);
+}
+
+static void time_sync_estimate(time_sync_t *sync) {
+    int64_t values[TIME_SYNC_WINDOW], locals[TIME_SYNC_WINDOW], offsets[TIME_SYNC_WINDOW];
+    time_sync_estimate_t *estimate = &(sync->estimates[((sync->sequence >> 1) + 1) & 1]);
+    int64_t history_offsets[TIME_SYNC_HISTORY];
+    time_sync_estimate_t fit;
+    size_t i, selected, count = 0, kept;
+    int64_t threshold, residual, spread, latest = 0;
+
+    // Readers still copying this estimate, the previous one, retry once they
+    // see the sequence change: the fence keeps that store ahead of the
+    // estimate stores below, see time_sync_read()
+    __atomic_store_n(&(sync->sequence), sync->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0; i < sync->count; i++) {
+        values[i] = sync->samples[i].rtt_us;
+        if (sync->samples[i].local_us > latest) {
+            latest = sync->samples[i].local_us;
+        }
+    }
+    time_sync_sort(values, sync->count);
+
+    // Keep the fastest quarter of the window
+    selected = sync->count / 4;
+    if (selected < TIME_SYNC_MIN_SELECTED) {
+        selected = TIME_SYNC_MIN_SELECTED;
+    }
+    if (selected > sync->count) {
+        selected = sync->count;
+    }
+    threshold = values[selected - 1];
+
+    for (i = 0; i < sync->count && count < selected; i++) {
+        if (sync->samples[i].rtt_us <= threshold) {
+            locals[count] = sync->samples[i].local_us;
+            offsets[count] = sync->samples[i].offset_us;
+            count++;
+        }
+    }
+    sync->rtt_us = threshold;
+
+    estimate->skew = 0;
+    if (count >= TIME_SYNC_MIN_REGRESSION && sync->history_count < TIME_SYNC_MIN_SELECTED) {
+        // Fit, then drop the samples further than 3 median deviations from
+        // the line (or 50 us, the resolution of the exchanges) and fit again
+        time_sync_fit(locals, offsets, count, &fit);
+        for (i = 0; i < count; i++) {
+            residual = offsets[i] - time_sync_predict(&fit, locals[i]);
+            values[i] = residual < 0 ? -residual : residual;
+        }
+        spread = 3 * time_sync_median(values, count);
+        if (spread < 50) {
+            spread = 50;
+        }
+
+        for (i = 0, kept = 0; i < count; i++) {
+            if (values[i] <= spread) {
+                locals[kept] = locals[i];
+                offsets[kept] = offsets[i];
+                kept++;
+            }
+        }
+        if (kept < count && kept >= TIME_SYNC_MIN_SELECTED) {
+            time_sync_fit(locals, offsets, kept, &fit);
+            count = kept;
+        }
+
+        estimate->skew = fit.skew;
+    }
+
+    // Past estimates span many windows, prefer their slope as soon as there
+    // are enough of them
+    if (sync->history_count >= TIME_SYNC_MIN_SELECTED) {
+        for (i = 0; i < sync->history_count; i++) {
+            values[i] = sync->history[i].local_us;
+            history_offsets[i] = sync->history[i].offset_us;
+        }
+        time_sync_fit(values, history_offsets, sync->history_count, &fit);
+        estimate->skew = fit.skew;
+    }
+
+    // Anchor at the latest sample: median of the selected offsets, each
+    // carried forward along the skew
+    for (i = 0; i < count; i++) {
+        values[i] = offsets[i] + (int64_t) ((latest - locals[i]) * estimate->skew);
+    }
+    estimate->local_us = latest;
+    estimate->offset_us = time_sync_median(values, count);
+
+    // Only settled estimates make it to the history
+    if (selected >= TIME_SYNC_MIN_REGRESSION
+        && (sync->history_count == 0 || latest - sync->history_last_us >= TIME_SYNC_HISTORY_INTERVAL_US)) {
+        sync->history[sync->history_next].local_us = estimate->local_us;
+        sync->history[sync->history_next].offset_us = estimate->offset_us;
+        sync->history_next = (sync->history_next + 1) % TIME_SYNC_HISTORY;
+        if (sync->history_count < TIME_SYNC_HISTORY) {
+            sync->history_count++;
+        }
+        sync->history_last_us = latest;
+    }
+
+    // Readers use the other estimate until this store
+    __atomic_store_n(&(sync->sequence), sync->sequence + 1, __ATOMIC_RELEASE);
+}
+
+int time_sync_add(time_sync_t *sync, int64_t local_us, int64_t c2s_us, int64_t s2c_us) {
+    time_sync_sample_t *sample;
+
+    if (c2s_us + s2c_us < 0) {
+        return 1;
+    }
+
+    sample = &(sync->samples[sync->next]);
+    sample->local_us = local_us;
+    sample->offset_us = (c2s_us - s2c_us) / 2;
+    sample->rtt_us = c2s_us + s2c_us;
+
+    sync->next = (sync->next + 1) % TIME_SYNC_WINDOW;
+    if (sync->count < TIME_SYNC_WINDOW) {
+        sync->count++;
+    }
+
+    time_sync_estimate(sync);
+    return 0;
+}
+
+bool time_sync_is_valid(const time_sync_t *sync) {
+    return sync->count > 0;
+}
+
+/*
+ * Copy the current estimate, from any task. The sequence is odd while the
+ * writer updates the other estimate, which readers keep copying. The
+ * writer only touches the estimate a reader copies after publishing the
+ * other one and making the sequence odd again, so an unchanged sequence
+ * means the copy was not torn, whatever the 64 bit accesses.
+ */
+static void time_sync_read(const time_sync_t *sync, time_sync_estimate_t *estimate) {
+    uint32_t sequence;
+
+    do {
+        sequence = __atomic_load_n(&(sync->sequence), __ATOMIC_ACQUIRE);
+        *estimate = sync->estimates[(sequence >> 1) & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&(sync->sequence), __ATOMIC_RELAXED) != sequence);
+}
+
+int64_t time_sync_server_time(const time_sync_t *sync, int64_t local_us) {
+    time_sync_estimate_t estimate;
+
+    time_sync_read(sync, &estimate);
+    return local_us + time_sync_predict(&estimate, local_us);
+}
+
+double time_sync_skew_ppm(const time_sync_t *sync) {
+    time_sync_estimate_t estimate;
+
+    time_sync_read(sync, &estimate);
+    return estimate.skew * 1e6;
+}
@@ -0,0 +1,87 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Tiny benchmark harness, usable both on the host and on the target (call the
+ * bench_* suites from app_main there).
+ */
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "xtensa/hal.h"
+
+#define BENCH_ITERATIONS 20000
+
+static inline int64_t bench_now_ns(void) {
+    return esp_timer_get_time() * 1000;
+}
+
+// CPU cycles, wrapping after 26 s at 160 MHz
+static inline uint64_t bench_cycles(void) {
+    return xthal_get_ccount();
+}
+#else
+#include <time.h>
+
+#define BENCH_ITERATIONS 2000000
+
+static inline int64_t bench_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Cycles are only counted on the target, host cycles say nothing of an LX6
+static inline uint64_t bench_cycles(void) {
+    return 0;
+}
+#endif
+
+// Results are accumulated here so that the compiler cannot drop the work
+extern volatile uint32_t bench_sink;
+
+/**
+ * Print one benchmark result line.
+ *
+ * @param[in] name The benchmark name.
+ * @param[in] elapsed_ns The total run time.
+ * @param[in] iterations The number of operations run.
+ * @param[in] bytes The number of bytes processed per operation, 0 to omit
+ *            the throughput.
+ */
+void bench_report(const char *name, int64_t elapsed_ns, long iterations, size_t bytes);
+
+typedef struct bench_heap {
+    long allocations;
+    long bytes;
+} bench_heap_t;
+
+/*
+ * Heap usage so far. Only tracked on the host, where the benchmark is linked
+ * with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc; always zero otherwise.
+ */
+extern bench_heap_t bench_heap;
+
+/**
+ * Print the heap usage per operation since "since".
+ *
+ * @param[in] name The benchmark name.
+ * @param[in] since The heap usage snapshot taken before the benchmark.
+ * @param[in] iterations The number of operations run.
+ */
+void bench_report_heap(const char *name, const bench_heap_t *since, long iterations);
+
+void bench_buffer(void);
+void bench_json(void);
+void bench_stream(void);
+void bench_time_sync(void);
+void bench_jitter_buffer(void);
+void bench_drift(void);
+// Replay a recorded stream, 1 if it cannot be read
+int bench_stream_file(const char *path);
+
+#endif // __BENCH_H__
@@ -0,0 +1,166 @@
+#include "bench.h"
+
+#include <buffer.h>
+#include <string.h>
+
+#define COPY_SIZE 4096
+#define BASE_HEADER_SIZE 26
+#define WIRE_CHUNK_HEADER_SIZE 12
+
+/*
+ * Byte at a time accessors, as libbuffer used to implement them, kept as the
+ * reference the fast paths are measured against.
+ */
+
+static int __attribute__((noinline)) bytewise_read_buffer(read_buffer_t *buffer, char *data, size_t size) {
+    size_t i;
+
+    if (buffer->size - buffer->index < size) {
+        return 1;
+    }
+
+    for (i = 0; i < size; i++) {
+        data[i] = buffer->buffer[buffer->index++];
+    }
+
+    return 0;
+}
+
+static int bytewise_read_uint32(read_buffer_t *buffer, uint32_t *data) {
+    if (buffer->size - buffer->index < sizeof(uint32_t)) {
+        return 1;
+    }
+
+    *data = buffer->buffer[buffer->index++] & 0xff;
+    *data |= (buffer->buffer[buffer->index++] & 0xff) << 8;
+    *data |= (buffer->buffer[buffer->index++] & 0xff) << 16;
+    *data |= (uint32_t) (buffer->buffer[buffer->index++] & 0xff) << 24;
+    return 0;
+}
+
+static int bytewise_read_uint16(read_buffer_t *buffer, uint16_t *data) {
+    if (buffer->size - buffer->index < sizeof(uint16_t)) {
+        return 1;
+    }
+
+    *data = buffer->buffer[buffer->index++] & 0xff;
+    *data |= (buffer->buffer[buffer->index++] & 0xff) << 8;
+    return 0;
+}
+
+static char source[COPY_SIZE];
+static char destination[COPY_SIZE];
+
+static void bench_copy(void) {
+    read_buffer_t buffer;
+    long iterations = BENCH_ITERATIONS / 100;
+    int64_t start;
+    long i;
+
+    start = bench_now_ns();
+    for (i = 0; i < iterations; i++) {
+        buffer_read_init(&buffer, source, sizeof(source));
+        bytewise_read_buffer(&buffer, destination, sizeof(destination));
+        bench_sink += destination[i % COPY_SIZE];
+    }
+    bench_report("buffer copy 4 KB, bytewise", bench_now_ns() - start, iterations, COPY_SIZE);
+
+    start = bench_now_ns();
+    for (i = 0; i < iterations; i++) {
+        buffer_read_init(&buffer, source, sizeof(source));
+        buffer_read_buffer(&buffer, destination, sizeof(destination));
+        bench_sink += destination[i % COPY_SIZE];
+    }
+    bench_report("buffer copy 4 KB, memcpy", bench_now_ns() - start, iterations, COPY_SIZE);
+}
+
+static void bench_base_header(void) {
+    read_buffer_t buffer;
+    const char *header;
+    uint16_t type, id, refers_to;
+    uint32_t values[5];
+    int64_t start;
+    long i;
+    int j;
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        buffer_read_init(&buffer, source, BASE_HEADER_SIZE);
+        bytewise_read_uint16(&buffer, &type);
+        bytewise_read_uint16(&buffer, &id);
+        bytewise_read_uint16(&buffer, &refers_to);
+        for (j = 0; j < 5; j++) {
+            bytewise_read_uint32(&buffer, &values[j]);
+        }
+        bench_sink += type + id + refers_to + values[4];
+    }
+    bench_report("base header, bytewise accessors", bench_now_ns() - start, BENCH_ITERATIONS, BASE_HEADER_SIZE);
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        buffer_read_init(&buffer, source, BASE_HEADER_SIZE);
+        buffer_read_uint16(&buffer, &type);
+        buffer_read_uint16(&buffer, &id);
+        buffer_read_uint16(&buffer, &refers_to);
+        for (j = 0; j < 5; j++) {
+            buffer_read_uint32(&buffer, &values[j]);
+        }
+        bench_sink += type + id + refers_to + values[4];
+    }
+    bench_report("base header, checked accessors", bench_now_ns() - start, BENCH_ITERATIONS, BASE_HEADER_SIZE);
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        buffer_read_init(&buffer, source, BASE_HEADER_SIZE);
+        header = buffer_read_reserve(&buffer, BASE_HEADER_SIZE);
+        type = buffer_load_uint16(header);
+        id = buffer_load_uint16(header + 2);
+        refers_to = buffer_load_uint16(header + 4);
+        for (j = 0; j < 5; j++) {
+            values[j] = buffer_load_uint32(header + 6 + 4 * j);
+        }
+        bench_sink += type + id + refers_to + values[4];
+    }
+    bench_report("base header, reserve + load", bench_now_ns() - start, BENCH_ITERATIONS, BASE_HEADER_SIZE);
+}
+
+static void bench_wire_chunk_header(void) {
+    read_buffer_t buffer;
+    const char *header;
+    uint32_t sec = 0, usec = 0, size = 0;
+    int64_t start;
+    long i;
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        buffer_read_init(&buffer, source, WIRE_CHUNK_HEADER_SIZE);
+        bytewise_read_uint32(&buffer, &sec);
+        bytewise_read_uint32(&buffer, &usec);
+        bytewise_read_uint32(&buffer, &size);
+        bench_sink += sec + usec + size;
+    }
+    bench_report("wire chunk header, bytewise", bench_now_ns() - start, BENCH_ITERATIONS, WIRE_CHUNK_HEADER_SIZE);
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        buffer_read_init(&buffer, source, WIRE_CHUNK_HEADER_SIZE);
+        header = buffer_read_reserve(&buffer, WIRE_CHUNK_HEADER_SIZE);
+        sec = buffer_load_uint32(header);
+        usec = buffer_load_uint32(header + 4);
+        size = buffer_load_uint32(header + 8);
+        bench_sink += sec + usec + size;
+    }
+    bench_report("wire chunk header, reserve + load", bench_now_ns() - start, BENCH_ITERATIONS, WIRE_CHUNK_HEADER_SIZE);
+}
+
+void bench_buffer(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(source); i++) {
+        source[i] = (char) (i * 31);
+    }
+
+    bench_copy();
+    bench_base_header();
+    bench_wire_chunk_header();
+}
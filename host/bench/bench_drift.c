@@ -0,0 +1,95 @@
+#include "bench.h"
+
+#include <drift_kernel.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DRIFT_RATE 48000
+#define DRIFT_CHANNELS 2
+#define DRIFT_BLOCK 512         // frames per element read (2 kB of stereo)
+#define DRIFT_FRAMES (DRIFT_RATE * 10)
+#ifdef CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+#define DRIFT_CPU_HZ (CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ * 1e6)
+#else
+#define DRIFT_CPU_HZ 160e6
+#endif
+
+// Only a block in and out is held, the signal is made as it is fed
+static int16_t drift_block[(DRIFT_BLOCK + 2 * DRIFT_KERNEL_HISTORY) * DRIFT_CHANNELS];
+static int16_t drift_output[DRIFT_BLOCK * 2 * DRIFT_CHANNELS];
+
+static double drift_signal(double frame, double hz) {
+    return 16000.0 * sin(2 * M_PI * hz * frame / DRIFT_RATE);
+}
+
+/*
+ * Run 10 s of 48 kHz stereo through the kernel the way the element does,
+ * in 2 kB reads with the leftover frames carried over, and compare the
+ * output with the ideal resampled sine as it comes out. Only the kernel
+ * calls and the carry over are timed.
+ */
+static void bench_drift_run(double ppm, double hz) {
+    drift_kernel_t kernel;
+    size_t held = DRIFT_KERNEL_TAPS / 2 - 1, fed = 0, produced = 0, compared = 0, consumed, count, i, n;
+    uint64_t cycles = 0, since;
+    int64_t elapsed = 0, start;
+    double error = 0, ratio, expected;
+    char name[64];
+
+    drift_kernel_init(&kernel, DRIFT_CHANNELS);
+    drift_kernel_set_ppm(&kernel, ppm);
+    memset(drift_block, 0, sizeof(drift_block));
+    ratio = 1 + kernel.step / 4294967296.0;
+
+    while (fed < DRIFT_FRAMES) {
+        n = DRIFT_FRAMES - fed < DRIFT_BLOCK ? DRIFT_FRAMES - fed : DRIFT_BLOCK;
+        for (i = 0; i < n; i++) {
+            drift_block[(held + i) * 2] = drift_block[(held + i) * 2 + 1] =
+                (int16_t) lrint(drift_signal(fed + i, hz));
+        }
+        fed += n;
+        held += n;
+
+        since = bench_cycles();
+        start = bench_now_ns();
+        count = drift_kernel_process(&kernel, drift_block, held, drift_output, DRIFT_BLOCK * 2, &consumed);
+        held -= consumed;
+        memmove(drift_block, drift_block + consumed * DRIFT_CHANNELS, held * DRIFT_CHANNELS * sizeof(int16_t));
+        elapsed += bench_now_ns() - start;
+        // CCOUNT is 32 bits, a block never takes long enough to wrap twice
+        cycles += (uint32_t) (bench_cycles() - since);
+
+        // output frame k is input frame k * (1 + ppm), the kernel starts right
+        // on the first frame after the silence one; skip the start
+        for (i = 0; i < count; i++, produced++) {
+            if (produced < 100) {
+                continue;
+            }
+            expected = drift_signal(produced * ratio, hz);
+            error += (drift_output[i * 2] - expected) * (drift_output[i * 2] - expected);
+            compared++;
+        }
+    }
+    error = sqrt(error / compared);
+
+    snprintf(name, sizeof(name), "drift %+4.0f ppm %5.0f Hz", ppm, hz);
+    bench_report(name, elapsed, produced * DRIFT_CHANNELS, 0);
+    // the share of a core only means something measured on the target
+    if (cycles) {
+        printf("%-36s %10.1f cycles/sample %6.2f%% of a %.0f MHz core, SNR %.1f dB\n", name,
+               (double) cycles / (produced * DRIFT_CHANNELS),
+               100.0 * cycles / (produced * DRIFT_CHANNELS) * DRIFT_RATE * DRIFT_CHANNELS / DRIFT_CPU_HZ,
+               DRIFT_CPU_HZ / 1e6, 20 * log10(16000.0 / M_SQRT2 / error));
+    } else {
+        printf("%-36s SNR %.1f dB\n", name, 20 * log10(16000.0 / M_SQRT2 / error));
+    }
+    bench_sink += produced;
+}
+
+void bench_drift(void) {
+    bench_drift_run(500, 1000);
+    bench_drift_run(0, 1000);
+    bench_drift_run(-500, 1000);
+    bench_drift_run(37, 10000);
+}
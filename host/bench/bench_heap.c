@@ -0,0 +1,34 @@
+#include "bench.h"
+
+#include <stdlib.h>
+
+bench_heap_t bench_heap;
+
+#ifndef ESP_PLATFORM
+/*
+ * Counting wrappers, active when linking with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc.
+ */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    bench_heap.allocations++;
+    bench_heap.bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    bench_heap.allocations++;
+    bench_heap.bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    bench_heap.allocations++;
+    bench_heap.bytes += size;
+    return __real_realloc(ptr, size);
+}
+#endif
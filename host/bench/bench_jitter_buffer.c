@@ -0,0 +1,194 @@
+#include "bench.h"
+
+#include <jitter_buffer.h>
+#include <latency_histogram.h>
+#include <snapclient_clock.h>
+#include <stdio.h>
+#include <string.h>
+
+#define JITTER_CHUNKS 128
+#define JITTER_CHUNK_US 20000
+#define JITTER_DELAY_US 1000000
+#define JITTER_CHUNK_SIZE 3840  // 20 ms of 48 kHz 16 bit stereo PCM
+
+static char chunk_payload[JITTER_CHUNK_SIZE];
+
+static void jitter_chunk(wire_chunk_message_t *chunk, int64_t timestamp_us) {
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->timestamp = tv_from_us(timestamp_us);
+    chunk->size = JITTER_CHUNK_SIZE;
+    chunk->payload = chunk_payload;
+}
+
+/*
+ * Steady state of the stream element: one chunk in for one chunk out, with
+ * bufferMs worth of chunks held. Each push copies the payload out of the
+ * framer, which is the one allocation per chunk.
+ */
+static void bench_jitter_buffer_steady(void) {
+    static jitter_buffer_t jb;
+    wire_chunk_message_t chunk;
+    jitter_buffer_entry_t *entry;
+    bench_heap_t heap;
+    int64_t start, elapsed, timestamp = 0;
+    long i, iterations = BENCH_ITERATIONS / 10;
+
+    jitter_buffer_init(&jb, JITTER_CHUNKS, JITTER_CHUNKS * JITTER_CHUNK_SIZE);
+    jitter_buffer_set_delay(&jb, JITTER_DELAY_US);
+    for (i = 0; i < JITTER_DELAY_US / JITTER_CHUNK_US; i++, timestamp += JITTER_CHUNK_US) {
+        jitter_chunk(&chunk, timestamp);
+        jitter_buffer_push(&jb, &chunk);
+    }
+
+    heap = bench_heap;
+    start = bench_now_ns();
+    for (i = 0; i < iterations; i++, timestamp += JITTER_CHUNK_US) {
+        jitter_chunk(&chunk, timestamp);
+        if (jitter_buffer_push(&jb, &chunk)) {
+            printf("jitter buffer: push failed\n");
+            break;
+        }
+        while ((entry = jitter_buffer_due(&jb, timestamp))) {
+            bench_sink += entry->chunk.payload[0];
+            jitter_buffer_pop(&jb);
+        }
+    }
+    elapsed = bench_now_ns() - start;
+    bench_report("jitter buffer push+release", elapsed, iterations, JITTER_CHUNK_SIZE);
+    bench_report_heap("jitter buffer push+release", &heap, iterations);
+
+    printf("%-36s %10zu chunks held, %u overflows\n", "jitter buffer 1000 ms",
+           jb.count, jb.stats.overflows);
+    jitter_buffer_deinit(&jb);
+}
+
+// A stalled output: the oldest chunks are dropped once the byte bound is hit
+static void bench_jitter_buffer_overflow(void) {
+    static jitter_buffer_t jb;
+    wire_chunk_message_t chunk;
+    long i;
+
+    jitter_buffer_init(&jb, JITTER_CHUNKS, 16 * JITTER_CHUNK_SIZE);
+    for (i = 0; i < JITTER_CHUNKS; i++) {
+        jitter_chunk(&chunk, i * JITTER_CHUNK_US);
+        jitter_buffer_push(&jb, &chunk);
+    }
+    printf("%-36s %10zu chunks held, %u overflows, oldest %lld us\n", "jitter buffer stalled",
+           jb.count, jb.stats.overflows,
+           (long long) jitter_buffer_peek(&jb)->timestamp_us);
+    jitter_buffer_deinit(&jb);
+}
+
+/*
+ * Start playback at arbitrary times around the first chunk, as a pcm
+ * stream (sample accurate) and as a compressed one (on the chunk play time,
+ * after a wait of up to the lead).
+ */
+static void bench_jitter_buffer_start(const char *name, uint32_t frame_size, int64_t lead_us) {
+    static jitter_buffer_t jb;
+    wire_chunk_message_t chunk;
+    jitter_buffer_start_t start;
+    int64_t now, max_error = 0, error;
+    long i, j, started = 0;
+
+    jitter_buffer_init(&jb, JITTER_CHUNKS, JITTER_CHUNKS * JITTER_CHUNK_SIZE);
+    for (i = 0; i < 1000; i++) {
+        jitter_buffer_clear(&jb);
+        for (j = 0; j < 8; j++) {
+            jitter_chunk(&chunk, j * JITTER_CHUNK_US);
+            jitter_buffer_push(&jb, &chunk);
+        }
+        // from 20 ms early to 100 ms late, in odd steps
+        now = -JITTER_CHUNK_US + i * 120 + i % 7;
+        if (!jitter_buffer_start(&jb, now, lead_us, 48000, frame_size, &start)) {
+            continue;
+        }
+        started++;
+        error = start.error_ns < 0 ? -start.error_ns : start.error_ns;
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+    printf("%-36s %10ld starts, max error %lld ns\n", name, started, (long long) max_error);
+    jitter_buffer_deinit(&jb);
+}
+
+// A backlog after a stall: everything past the deadline goes at once
+static void bench_jitter_buffer_late(void) {
+    static jitter_buffer_t jb;
+    wire_chunk_message_t chunk;
+    int64_t dropped_us;
+    size_t dropped;
+    long i;
+
+    jitter_buffer_init(&jb, JITTER_CHUNKS, JITTER_CHUNKS * JITTER_CHUNK_SIZE);
+    for (i = 0; i < 50; i++) {
+        jitter_chunk(&chunk, i * JITTER_CHUNK_US);
+        jitter_buffer_push(&jb, &chunk);
+    }
+    // 300 ms late, 40 ms tolerance
+    dropped = jitter_buffer_drop_late(&jb, 300000 - 40000, 0, 0, &dropped_us);
+    printf("%-36s %10zu chunks dropped, %lld ms, next at %lld us\n", "jitter buffer late",
+           dropped, (long long) dropped_us / 1000, (long long) jitter_buffer_peek(&jb)->timestamp_us);
+    jitter_buffer_deinit(&jb);
+}
+
+// Growing and shrinking the ring keeps the chunks in order
+static void bench_jitter_buffer_resize(void) {
+    static jitter_buffer_t jb;
+    wire_chunk_message_t chunk;
+    long i;
+
+    jitter_buffer_init(&jb, 16, JITTER_CHUNKS * JITTER_CHUNK_SIZE);
+    for (i = 0; i < 24; i++) {
+        jitter_chunk(&chunk, i * JITTER_CHUNK_US);
+        jitter_buffer_push(&jb, &chunk);
+        jitter_buffer_pop(&jb);
+        jitter_chunk(&chunk, i * JITTER_CHUNK_US + 1);
+        jitter_buffer_push(&jb, &chunk);
+    }
+    jitter_buffer_resize(&jb, 64, JITTER_CHUNKS * JITTER_CHUNK_SIZE);
+    jitter_buffer_resize(&jb, 8, 4 * JITTER_CHUNK_SIZE);
+    printf("%-36s %10zu chunks held, %u overflows, oldest %lld us\n", "jitter buffer resized",
+           jb.count, jb.stats.overflows, (long long) jitter_buffer_peek(&jb)->timestamp_us);
+    jitter_buffer_deinit(&jb);
+}
+
+/*
+ * Chunk arrivals over wifi: a few ms of server and network delay, with one
+ * chunk in 50 held by a retransmission burst of up to 150 ms. The lateness
+ * quantile must cover the bursts, the maximum must not drive it.
+ */
+static void bench_jitter_buffer_lateness(void) {
+    static latency_histogram_t histogram;
+    uint32_t seed = 1;
+    int64_t lateness_us;
+    long i;
+
+    latency_histogram_init(&histogram);
+    for (i = 0; i < 30000; i++) {
+        seed = seed * 1103515245 + 12345;
+        lateness_us = 2000 + (seed >> 8) % 4000;
+        if ((seed >> 16) % 50 == 0) {
+            lateness_us += (seed >> 4) % 150000;
+        }
+        if (i == 29000) {
+            lateness_us = 900000;   // one stall
+        }
+        latency_histogram_add(&histogram, lateness_us);
+    }
+    printf("%-36s %10lld us p99, %lld us p99.9, %lld us max\n", "latency histogram wifi",
+           (long long) latency_histogram_quantile(&histogram, 0.99),
+           (long long) latency_histogram_quantile(&histogram, 0.999),
+           (long long) histogram.max_us);
+}
+
+void bench_jitter_buffer(void) {
+    bench_jitter_buffer_steady();
+    bench_jitter_buffer_overflow();
+    bench_jitter_buffer_start("jitter buffer start pcm", 4, JITTER_CHUNK_US);
+    bench_jitter_buffer_start("jitter buffer start compressed", 0, 2 * 10000);
+    bench_jitter_buffer_late();
+    bench_jitter_buffer_resize();
+    bench_jitter_buffer_lateness();
+}
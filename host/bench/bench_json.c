@@ -0,0 +1,83 @@
+#include "bench.h"
+
+#include <snapcast.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_CJSON
+#include <cJSON.h>
+#endif
+
+static const char settings_json[] =
+    "{\"bufferMs\":1000,\"latency\":0,\"muted\":false,\"volume\":100}";
+
+static char settings_payload[sizeof(settings_json) + 3];
+
+#ifdef HAVE_CJSON
+static char scratch[sizeof(settings_payload) + 1];
+
+/*
+ * The server settings path as it was before the in place tokenizer: shift the
+ * payload over its length prefix and build a cJSON tree.
+ */
+static int cjson_server_settings_deserialize(server_settings_message_t *msg, char *data, uint32_t size) {
+    cJSON *json, *value;
+
+    memmove(data, data + 4, size - 4);
+    data[size - 4] = '\0';
+
+    json = cJSON_Parse(data);
+    if (!json) {
+        return 1;
+    }
+
+    value = cJSON_GetObjectItemCaseSensitive(json, "bufferMs");
+    if (cJSON_IsNumber(value)) {
+        msg->buffer_ms = value->valueint;
+    }
+    value = cJSON_GetObjectItemCaseSensitive(json, "latency");
+    if (cJSON_IsNumber(value)) {
+        msg->latency = value->valueint;
+    }
+    value = cJSON_GetObjectItemCaseSensitive(json, "volume");
+    if (cJSON_IsNumber(value)) {
+        msg->volume = value->valueint;
+    }
+    value = cJSON_GetObjectItemCaseSensitive(json, "muted");
+    msg->muted = cJSON_IsTrue(value);
+
+    cJSON_Delete(json);
+    return 0;
+}
+#endif
+
+void bench_json(void) {
+    server_settings_message_t msg;
+    bench_heap_t heap;
+    int64_t start;
+    long i;
+
+    buffer_store_uint32(settings_payload, sizeof(settings_json) - 1);
+    memcpy(settings_payload + 4, settings_json, sizeof(settings_json) - 1);
+
+#ifdef HAVE_CJSON
+    heap = bench_heap;
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS / 10; i++) {
+        memcpy(scratch, settings_payload, sizeof(settings_payload));
+        cjson_server_settings_deserialize(&msg, scratch, sizeof(settings_payload));
+        bench_sink += msg.buffer_ms;
+    }
+    bench_report("server settings, cJSON", bench_now_ns() - start, BENCH_ITERATIONS / 10, 0);
+    bench_report_heap("server settings, cJSON", &heap, BENCH_ITERATIONS / 10);
+#endif
+
+    heap = bench_heap;
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS / 10; i++) {
+        server_settings_message_deserialize(&msg, settings_payload, sizeof(settings_payload));
+        bench_sink += msg.buffer_ms;
+    }
+    bench_report("server settings, in place tokenizer", bench_now_ns() - start, BENCH_ITERATIONS / 10, 0);
+    bench_report_heap("server settings, in place tokenizer", &heap, BENCH_ITERATIONS / 10);
+}
@@ -0,0 +1,59 @@
+/*
+ * Host benchmarks for libbuffer, lightsnapcast, the stream time sync and
+ * jitter buffer and the drift resampler kernel, see host/CMakeLists.txt.
+ *
+ * Recorded streams (the raw bytes a snapserver sends on port 1704 after the
+ * Hello, for instance saved from a packet capture) can be given as
+ * arguments to be replayed through the framer and message decoders.
+ *
+ * On the target, host/bench/target builds them into an ESP-IDF app that runs
+ * the drift suite from app_main: timings then come from esp_timer and
+ * bench_cycles() from CCOUNT, heap counts are not tracked. The host numbers
+ * only compare code paths with each other, they say nothing of the time
+ * spent on an ESP32.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+volatile uint32_t bench_sink;
+
+void bench_report(const char *name, int64_t elapsed_ns, long iterations, size_t bytes) {
+    double ns_per_op = (double) elapsed_ns / iterations;
+
+    if (bytes) {
+        printf("%-36s %10.1f ns/op %10.1f MB/s\n", name, ns_per_op,
+               (double) bytes * 1000.0 / ns_per_op);
+    } else {
+        printf("%-36s %10.1f ns/op\n", name, ns_per_op);
+    }
+}
+
+void bench_report_heap(const char *name, const bench_heap_t *since, long iterations) {
+#ifndef ESP_PLATFORM
+    printf("%-36s %10.1f allocs/op %8.1f bytes/op\n", name,
+           (double) (bench_heap.allocations - since->allocations) / iterations,
+           (double) (bench_heap.bytes - since->bytes) / iterations);
+#endif
+}
+
+#ifndef ESP_PLATFORM
+int main(int argc, char **argv) {
+    int i;
+
+    bench_buffer();
+    bench_json();
+    bench_stream();
+    bench_time_sync();
+    bench_jitter_buffer();
+    bench_drift();
+
+    for (i = 1; i < argc; i++) {
+        if (bench_stream_file(argv[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,336 @@
+#include "bench.h"
+
+#include <framer.h>
+#include <snapcast.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_SIZE (1024 * 1024)
+#define FRAME_BUF_SIZE (8 * 1024)
+#define MAX_FRAGMENT 4096
+#define PCM_CHUNK_SIZE 3840     // 20 ms of 48 kHz 16 bits stereo
+
+typedef struct bench_stream {
+    char *data;
+    size_t size;
+    long messages;
+} bench_stream_t;
+
+// Per message type decoding state, as kept by the stream element
+static codec_header_message_t codec_header_message;
+static wire_chunk_message_t wire_chunk_message;
+static server_settings_message_t server_settings_message;
+static time_message_t time_message;
+static stream_tags_message_t stream_tags_message, stream_tags_scratch;
+
+static char frame_buffer[FRAME_BUF_SIZE];
+static char scratch[8 * 1024];
+
+static const char *message_names[] = {
+    "base", "codec header", "wire chunk", "server settings", "time", "hello", "stream tags",
+};
+
+static int bench_decode(const message_frame_t *frame) {
+    int result = 0;
+
+    switch (frame->base.type) {
+        case SNAPCAST_MESSAGE_CODEC_HEADER:
+            result = codec_header_message_deserialize(&codec_header_message, frame->payload, frame->base.size);
+            codec_header_message_free(&codec_header_message);
+            break;
+        case SNAPCAST_MESSAGE_WIRE_CHUNK:
+            result = wire_chunk_message_deserialize(&wire_chunk_message, frame->payload, frame->base.size);
+            bench_sink += wire_chunk_message.payload[0];
+            wire_chunk_message_free(&wire_chunk_message);
+            break;
+        case SNAPCAST_MESSAGE_SERVER_SETTINGS:
+            result = server_settings_message_deserialize(&server_settings_message, frame->payload, frame->base.size);
+            break;
+        case SNAPCAST_MESSAGE_TIME:
+            result = time_message_deserialize(&time_message, frame->payload, frame->base.size);
+            break;
+        case SNAPCAST_MESSAGE_STREAM_TAGS:
+            if (stream_tags_message_changed(&stream_tags_message, frame->payload, frame->base.size)) {
+                result = stream_tags_message_deserialize(&stream_tags_message, &stream_tags_scratch,
+                                                         frame->payload, frame->base.size);
+            }
+            break;
+        default:
+            break;
+    }
+
+    return result;
+}
+
+/*
+ * Feed the stream through the framer in pseudo random fragments, like TCP
+ * reads would deliver it, and decode every message. Returns the number of
+ * messages, or -1 if any of them failed to decode.
+ */
+static long bench_replay(const bench_stream_t *stream, long counts[SNAPCAST_MESSAGE_LAST + 1]) {
+    message_frame_t frame;
+    framer_t framer;
+    uint32_t seed = 1;
+    size_t index = 0, fragment;
+    long messages = 0;
+    int result;
+
+    framer_init(&framer, frame_buffer, sizeof(frame_buffer));
+    stream_tags_message_init(&stream_tags_message);
+
+    while (index < stream->size) {
+        seed = seed * 1103515245 + 12345;
+        fragment = 1 + (seed >> 8) % MAX_FRAGMENT;
+        if (fragment > stream->size - index) {
+            fragment = stream->size - index;
+        }
+        framer_feed(&framer, stream->data + index, fragment, index);
+        index += fragment;
+
+        while ((result = framer_next(&framer, &frame)) != 1) {
+            if (result || bench_decode(&frame)) {
+                return -1;
+            }
+            if (counts && frame.base.type <= SNAPCAST_MESSAGE_LAST) {
+                counts[frame.base.type]++;
+            }
+            messages++;
+        }
+    }
+
+    return messages;
+}
+
+static void bench_stream_append(bench_stream_t *stream, uint16_t type, const char *payload, uint32_t size) {
+    base_message_t base = { type, (uint16_t) stream->messages, 0, { 1, 2 }, { 0, 0 }, size };
+
+    base_message_serialize(&base, stream->data + stream->size, BASE_MESSAGE_SIZE);
+    memcpy(stream->data + stream->size + BASE_MESSAGE_SIZE, payload, size);
+    stream->size += BASE_MESSAGE_SIZE + size;
+    stream->messages++;
+}
+
+static uint32_t bench_json_payload(char *out, const char *json) {
+    uint32_t size = strlen(json);
+
+    buffer_store_uint32(out, size);
+    memcpy(out + 4, json, size);
+    return size + 4;
+}
+
+static uint32_t bench_codec_header_payload(char *out) {
+    static const char riff[44] = "RIFF\x24\xff\xff\xff" "WAVEfmt "
+        "\x10\x00\x00\x00\x01\x00\x02\x00\x80\xbb\x00\x00\x00\xee\x02\x00\x04\x00\x10\x00"
+        "data\x00\xff\xff\xff";
+
+    buffer_store_uint32(out, 3);
+    memcpy(out + 4, "pcm", 3);
+    buffer_store_uint32(out + 7, sizeof(riff));
+    memcpy(out + 11, riff, sizeof(riff));
+    return 11 + sizeof(riff);
+}
+
+static uint32_t bench_wire_chunk_payload(char *out, long index, uint32_t size) {
+    buffer_store_uint32(out, index / 50);
+    buffer_store_uint32(out + 4, (index % 50) * 20000);
+    buffer_store_uint32(out + 8, size);
+    memset(out + WIRE_CHUNK_HEADER_SIZE, (int) index, size);
+    return WIRE_CHUNK_HEADER_SIZE + size;
+}
+
+static uint32_t bench_stream_tags_payload(char *out, long index) {
+    char json[256];
+
+    snprintf(json, sizeof(json),
+             "{\"STREAM\":\"default\",\"xesam:title\":\"Track %ld\","
+             "\"xesam:artist\":[\"Some Artist\",\"Another One\"],"
+             "\"xesam:album\":\"The Album\",\"mpris:artUrl\":\"http://example.org/cover.jpg\"}",
+             index);
+    return bench_json_payload(out, json);
+}
+
+// Fill the stream with copies of one message type, until it is full
+static void bench_stream_build(bench_stream_t *stream, int type, int variant) {
+    uint32_t size;
+    long i;
+
+    stream->size = 0;
+    stream->messages = 0;
+
+    for (i = 0; ; i++) {
+        switch (type) {
+            case SNAPCAST_MESSAGE_CODEC_HEADER:
+                size = bench_codec_header_payload(scratch);
+                break;
+            case SNAPCAST_MESSAGE_WIRE_CHUNK:
+                size = bench_wire_chunk_payload(scratch, i, variant ? variant : PCM_CHUNK_SIZE);
+                break;
+            case SNAPCAST_MESSAGE_SERVER_SETTINGS:
+                size = bench_json_payload(scratch, "{\"bufferMs\":1000,\"latency\":0,\"muted\":false,\"volume\":100}");
+                break;
+            case SNAPCAST_MESSAGE_TIME:
+                memset(scratch, 0, TIME_MESSAGE_SIZE);
+                size = TIME_MESSAGE_SIZE;
+                break;
+            case SNAPCAST_MESSAGE_STREAM_TAGS:
+                // variant 0: new tags every time, otherwise always the same
+                size = bench_stream_tags_payload(scratch, variant ? 0 : i);
+                break;
+            default:
+                // A realistic mix: PCM chunks, a time reply every second
+                // and the occasional settings and tags update
+                if (i % 50 == 0) {
+                    size = TIME_MESSAGE_SIZE;
+                    memset(scratch, 0, size);
+                    type = SNAPCAST_MESSAGE_TIME;
+                } else if (i % 500 == 1) {
+                    size = bench_stream_tags_payload(scratch, i / 1000);
+                    type = SNAPCAST_MESSAGE_STREAM_TAGS;
+                } else if (i % 500 == 2) {
+                    size = bench_json_payload(scratch, "{\"bufferMs\":1000,\"latency\":0,\"muted\":false,\"volume\":100}");
+                    type = SNAPCAST_MESSAGE_SERVER_SETTINGS;
+                } else {
+                    size = bench_wire_chunk_payload(scratch, i, PCM_CHUNK_SIZE);
+                    type = SNAPCAST_MESSAGE_WIRE_CHUNK;
+                }
+                if (stream->size + BASE_MESSAGE_SIZE + size > STREAM_SIZE) {
+                    return;
+                }
+                bench_stream_append(stream, type, scratch, size);
+                type = -1;
+                continue;
+        }
+
+        if (stream->size + BASE_MESSAGE_SIZE + size > STREAM_SIZE) {
+            return;
+        }
+        bench_stream_append(stream, type, scratch, size);
+    }
+}
+
+static void bench_stream_run(const char *name, const bench_stream_t *stream, int repeat) {
+    bench_heap_t heap = bench_heap;
+    long messages = 0, result;
+    int64_t start, elapsed;
+    int i;
+
+    start = bench_now_ns();
+    for (i = 0; i < repeat; i++) {
+        result = bench_replay(stream, NULL);
+        if (result < 0) {
+            printf("%-36s decoding failed\n", name);
+            return;
+        }
+        messages += result;
+    }
+    elapsed = bench_now_ns() - start;
+
+    printf("%-36s %10.0f msg/s %8.1f MB/s %8.1f ns/msg %6.2f allocs/msg\n", name,
+           messages * 1e9 / elapsed,
+           (double) stream->size * repeat * 1000.0 / elapsed,
+           (double) elapsed / messages,
+           (double) (bench_heap.allocations - heap.allocations) / messages);
+}
+
+static void bench_header(void) {
+    base_message_t base = { SNAPCAST_MESSAGE_WIRE_CHUNK, 1, 0, { 1, 2 }, { 3, 4 }, PCM_CHUNK_SIZE };
+    int64_t start;
+    long i;
+
+    base_message_serialize(&base, scratch, BASE_MESSAGE_SIZE);
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        base_message_deserialize(&base, scratch, BASE_MESSAGE_SIZE);
+        bench_sink += base.size;
+    }
+    bench_report("base header deserialize", bench_now_ns() - start, BENCH_ITERATIONS, 0);
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        base.id = i;
+        base_message_serialize(&base, scratch, BASE_MESSAGE_SIZE);
+        bench_sink += scratch[2];
+    }
+    bench_report("base header serialize", bench_now_ns() - start, BENCH_ITERATIONS, 0);
+}
+
+void bench_stream(void) {
+    static const struct {
+        const char *name;
+        int type;
+        int variant;
+    } streams[] = {
+        { "stream: codec header", SNAPCAST_MESSAGE_CODEC_HEADER, 0 },
+        { "stream: wire chunk (pcm 3840 B)", SNAPCAST_MESSAGE_WIRE_CHUNK, 0 },
+        { "stream: wire chunk (opus 160 B)", SNAPCAST_MESSAGE_WIRE_CHUNK, 160 },
+        { "stream: server settings", SNAPCAST_MESSAGE_SERVER_SETTINGS, 0 },
+        { "stream: time", SNAPCAST_MESSAGE_TIME, 0 },
+        { "stream: stream tags (changing)", SNAPCAST_MESSAGE_STREAM_TAGS, 0 },
+        { "stream: stream tags (repeated)", SNAPCAST_MESSAGE_STREAM_TAGS, 1 },
+        { "stream: mixed", -1, 0 },
+    };
+    bench_stream_t stream;
+    size_t i;
+
+    bench_header();
+
+    stream.data = malloc(STREAM_SIZE);
+    if (!stream.data) {
+        return;
+    }
+
+    for (i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+        bench_stream_build(&stream, streams[i].type, streams[i].variant);
+        bench_stream_run(streams[i].name, &stream, 20);
+    }
+
+    free(stream.data);
+}
+
+int bench_stream_file(const char *path) {
+    long counts[SNAPCAST_MESSAGE_LAST + 1] = { 0 };
+    bench_stream_t stream;
+    long size;
+    FILE *file;
+    int i;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    stream.data = malloc(size);
+    if (!stream.data || fread(stream.data, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "%s: cannot read the stream\n", path);
+        free(stream.data);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+    stream.size = size;
+
+    // Recorded streams are not guaranteed to end on a message boundary
+    stream.messages = bench_replay(&stream, counts);
+    if (stream.messages < 0) {
+        fprintf(stderr, "%s: decoding failed\n", path);
+        free(stream.data);
+        return 1;
+    }
+
+    printf("%s: %ld messages in %ld bytes\n", path, stream.messages, size);
+    for (i = SNAPCAST_MESSAGE_CODEC_HEADER; i <= SNAPCAST_MESSAGE_LAST; i++) {
+        if (counts[i]) {
+            printf("  %-16s %ld\n", message_names[i], counts[i]);
+        }
+    }
+    bench_stream_run("recorded stream", &stream, 10);
+
+    free(stream.data);
+    return 0;
+}
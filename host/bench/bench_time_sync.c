@@ -0,0 +1,181 @@
+#include "bench.h"
+
+#include <time_sync.h>
+#include <sync_scheduler.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SYNC_SAMPLES 2000
+#define SYNC_WARMUP 10
+#define SYNC_RUN_US (3600LL * 1000000)
+#define SYNC_WARMUP_US (SYNC_RUN_US / 2)   // crystal warming up until then
+#define SYNC_WARMUP_PPM 20.0
+#define SYNC_TOLERANCE_US 500
+
+typedef struct sync_scenario {
+    const char *name;
+    int64_t base_us;        // one way network latency
+    int64_t jitter_us;      // always present jitter
+    int congestion;         // percentage of delays hitting a queue
+    int64_t queue_us;       // worst queuing delay
+    double skew_ppm;        // server clock rate error
+} sync_scenario_t;
+
+static const sync_scenario_t scenarios[] = {
+    { "lan", 500, 200, 0, 0, 0 },
+    { "wifi", 2000, 1000, 10, 20000, 0 },
+    { "congested wifi", 2000, 2000, 40, 80000, 0 },
+    { "wifi, 40 ppm skew", 2000, 1000, 10, 20000, 40 },
+    { "congested wifi, -80 ppm skew", 2000, 2000, 40, 80000, -80 },
+};
+
+static uint32_t seed = 1;
+
+static int64_t sync_random(int64_t max) {
+    seed = seed * 1103515245 + 12345;
+    return max ? (int64_t) (seed >> 8) % max : 0;
+}
+
+static int64_t sync_delay(const sync_scenario_t *scenario) {
+    int64_t delay = scenario->base_us + sync_random(scenario->jitter_us);
+
+    if (sync_random(100) < scenario->congestion) {
+        delay += sync_random(scenario->queue_us);
+    }
+    return delay;
+}
+
+/*
+ * Simulate Time message exchanges, once a second, with a server clock ahead
+ * of the client and drifting from it, and independent jitter on each
+ * direction. The error of the estimator, measured half way to the next
+ * exchange, is compared with using the last sample alone.
+ */
+static void bench_time_sync_scenario(const sync_scenario_t *scenario) {
+    static time_sync_t sync;
+    int64_t local = 1000000, offset, c2s, s2c, error;
+    double naive_error = 0, sync_error = 0;
+    int64_t naive_max = 0, sync_max = 0;
+    int i;
+
+    time_sync_init(&sync);
+
+    for (i = 0; i < SYNC_SAMPLES; i++) {
+        local += 1000000;
+        offset = 123456789 + (int64_t) (local * scenario->skew_ppm / 1e6);
+        c2s = offset + sync_delay(scenario);
+        s2c = sync_delay(scenario) - offset;
+        time_sync_add(&sync, local, c2s, s2c);
+
+        if (i < SYNC_WARMUP) {
+            continue;
+        }
+
+        error = llabs((c2s - s2c) / 2 - offset);
+        naive_error += error;
+        naive_max = error > naive_max ? error : naive_max;
+
+        offset = 123456789 + (int64_t) ((local + 500000) * scenario->skew_ppm / 1e6);
+        error = llabs(time_sync_server_time(&sync, local + 500000) - local - 500000 - offset);
+        sync_error += error;
+        sync_max = error > sync_max ? error : sync_max;
+    }
+
+    printf("time sync %-30s last sample %6.0f us avg %6lld us max, "
+           "estimator %5.0f us avg %5lld us max, skew %6.1f ppm\n", scenario->name,
+           naive_error / (SYNC_SAMPLES - SYNC_WARMUP), (long long) naive_max,
+           sync_error / (SYNC_SAMPLES - SYNC_WARMUP), (long long) sync_max,
+           time_sync_skew_ppm(&sync));
+}
+
+// The skew drifts linearly by SYNC_WARMUP_PPM during the first half hour
+static int64_t sync_server_offset(const sync_scenario_t *scenario, int64_t local) {
+    double warmup = local < SYNC_WARMUP_US
+        ? (double) local * local / (2 * SYNC_WARMUP_US)
+        : local - SYNC_WARMUP_US / 2.0;
+
+    return 123456789 + (int64_t) (local * scenario->skew_ppm / 1e6 + warmup * SYNC_WARMUP_PPM / 1e6);
+}
+
+/*
+ * Run the exchanges for an hour as scheduled by the sync scheduler, or once a
+ * second as before if "adaptive" is false, while the client crystal warms
+ * up. Reports how long the estimate takes to get within tolerance, its error
+ * half way between exchanges once there, and how many requests were sent.
+ */
+static void bench_time_sync_schedule(const sync_scenario_t *scenario, bool adaptive) {
+    static time_sync_t sync;
+    static sync_scheduler_t scheduler;
+    int64_t local = 0, received, c2s, s2c, residual, error, error_max = 0;
+    int64_t converged = -1;
+    double error_sum = 0;
+    long requests = 0, measures = 0;
+    uint32_t next_ms;
+    uint16_t id = 0;
+
+    time_sync_init(&sync);
+    sync_scheduler_init(&scheduler);
+
+    while (local < SYNC_RUN_US) {
+        next_ms = sync_scheduler_sent(&scheduler, id);
+        if (!adaptive) {
+            next_ms = 1000;
+        }
+        requests++;
+
+        c2s = sync_server_offset(scenario, local) + sync_delay(scenario);
+        received = local + c2s - sync_server_offset(scenario, local);
+        s2c = sync_delay(scenario);
+        received += s2c;
+        s2c -= sync_server_offset(scenario, received);
+
+        residual = (c2s - s2c) / 2 - (time_sync_server_time(&sync, received) - received);
+        if (sync_scheduler_reply(&scheduler, id, residual, c2s + s2c <= sync.rtt_us) > 0) {
+            next_ms = SYNC_SCHEDULER_MIN_INTERVAL_MS;
+        }
+        time_sync_add(&sync, received, c2s, s2c);
+        id++;
+
+        // Error of the server time in use until the next exchange
+        local += next_ms * 1000LL;
+        error = llabs(time_sync_server_time(&sync, (received + local) / 2)
+                      - (received + local) / 2 - sync_server_offset(scenario, (received + local) / 2));
+        if (converged < 0 && error < SYNC_TOLERANCE_US) {
+            converged = received;
+        }
+        if (converged >= 0) {
+            error_sum += error;
+            error_max = error > error_max ? error : error_max;
+            measures++;
+        }
+    }
+
+    printf("time sync %-30s %-8s synced in %4.1f s, %5.0f us avg %5lld us max, %5ld requests/h\n",
+           scenario->name, adaptive ? "adaptive" : "1 Hz", converged / 1e6,
+           error_sum / measures, (long long) error_max, requests);
+}
+
+void bench_time_sync(void) {
+    static time_sync_t sync;
+    long i, iterations = BENCH_ITERATIONS / 10;
+    int64_t start;
+    size_t s;
+
+    for (s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        bench_time_sync_scenario(&scenarios[s]);
+    }
+    for (s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        bench_time_sync_schedule(&scenarios[s], false);
+        bench_time_sync_schedule(&scenarios[s], true);
+    }
+
+    // Cost of one sample on a full window
+    time_sync_init(&sync);
+    start = bench_now_ns();
+    for (i = 0; i < iterations; i++) {
+        time_sync_add(&sync, i * 1000000, 1000 + sync_random(5000), 1000 + sync_random(5000));
+    }
+    bench_report("time sync add (full window)", bench_now_ns() - start, iterations, 0);
+    bench_sink += (uint32_t) time_sync_server_time(&sync, 0);
+}
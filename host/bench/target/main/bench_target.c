@@ -0,0 +1,14 @@
+/*
+ * Target entry point of the benchmarks: the suites only depending on
+ * portable code that matters on the ESP32 are run once at boot.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+void app_main(void) {
+    printf("snapcast benchmarks, %d MHz\n", CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+    bench_drift();
+    printf("done\n");
+}
@@ -0,0 +1,35 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+
+/*
+ * Host unit tests, run by ctest (see host/CMakeLists.txt). A failed check
+ * prints where and why and makes the run fail, the suite goes on.
+ */
+
+extern int test_failures;
+
+#define TEST_CHECK(cond, ...)                                       \
+    do {                                                            \
+        if (!(cond)) {                                              \
+            test_failures++;                                        \
+            printf("%s:%d: %s: ", __FILE__, __LINE__, #cond);       \
+            printf(__VA_ARGS__);                                    \
+            printf("\n");                                           \
+        }                                                           \
+    } while (0)
+
+// Heap usage, and a limit making allocations fail past it (-1 for none)
+extern long test_heap_limit;
+extern long test_heap_used;
+
+void test_framer(void);
+void test_stream_tags(void);
+void test_time_sync(void);
+void test_jitter_buffer(void);
+void test_playout(void);
+// Check the framer on a recorded stream, 1 if it cannot be read
+int test_framer_file(const char *path);
+
+#endif // __TEST_H__
@@ -0,0 +1,235 @@
+#include "test.h"
+
+#include <framer.h>
+#include <snapcast.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_SIZE (512 * 1024)
+#define FRAME_BUF_SIZE (8 * 1024)  // as SNAPCLIENT_STREAM_FRAME_BUF_SIZE
+#define MAX_PAYLOAD (FRAME_BUF_SIZE - BASE_MESSAGE_SIZE)
+
+typedef struct test_stream {
+    char *data;
+    size_t size;
+    size_t *offsets;    // start of each complete message
+    long messages;
+} test_stream_t;
+
+static char frame_buffer[FRAME_BUF_SIZE];
+static uint32_t seed;
+
+static uint32_t test_random(uint32_t max) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % max;
+}
+
+// Index the complete messages of a stream, a truncated last one is left out
+static int test_stream_index(test_stream_t *stream) {
+    base_message_t base;
+    size_t index = 0;
+
+    stream->messages = 0;
+    stream->offsets = malloc((stream->size / BASE_MESSAGE_SIZE + 1) * sizeof(size_t));
+    if (!stream->offsets) {
+        return 1;
+    }
+    while (stream->size - index >= BASE_MESSAGE_SIZE) {
+        base_message_deserialize(&base, stream->data + index, BASE_MESSAGE_SIZE);
+        if (base.size > stream->size - index - BASE_MESSAGE_SIZE) {
+            break;
+        }
+        stream->offsets[stream->messages++] = index;
+        index += BASE_MESSAGE_SIZE + base.size;
+    }
+    return 0;
+}
+
+/*
+ * Messages of every size class: empty, Time sized, chunk sized, exactly
+ * the largest the reassembly area holds, one byte over it and far over it.
+ * Payloads are random so that a misplaced byte shows.
+ */
+static void test_stream_build(test_stream_t *stream) {
+    static const uint32_t sizes[] = {
+        0, TIME_MESSAGE_SIZE, 160, 3840, MAX_PAYLOAD, MAX_PAYLOAD + 1, 20000,
+    };
+    base_message_t base = { 0 };
+    uint32_t size, i;
+
+    stream->size = 0;
+    seed = 7;
+    for (;;) {
+        size = sizes[test_random(sizeof(sizes) / sizeof(sizes[0]))];
+        if (size == 3840 || size == 160) {
+            size -= test_random(size / 2);
+        }
+        if (stream->size + BASE_MESSAGE_SIZE + size > STREAM_SIZE) {
+            break;
+        }
+
+        base.type = 1 + test_random(SNAPCAST_MESSAGE_LAST);
+        base.id++;
+        base.refersTo = test_random(65536);
+        base.sent.sec = test_random(100000);
+        base.sent.usec = test_random(1000000);
+        base.received.sec = -1;
+        base.received.usec = test_random(1000000);
+        base.size = size;
+        base_message_serialize(&base, stream->data + stream->size, BASE_MESSAGE_SIZE);
+        stream->size += BASE_MESSAGE_SIZE;
+        for (i = 0; i < size; i++) {
+            stream->data[stream->size++] = (char) test_random(256);
+        }
+    }
+}
+
+static int test_base_equals(const base_message_t *a, const base_message_t *b) {
+    return a->type == b->type && a->id == b->id && a->refersTo == b->refersTo
+        && a->sent.sec == b->sent.sec && a->sent.usec == b->sent.usec
+        && a->received.sec == b->received.sec && a->received.usec == b->received.usec
+        && a->size == b->size;
+}
+
+/*
+ * Split the stream in random fragments of up to "max_fragment" bytes and
+ * check that the framer gives back every message as it was, in order,
+ * stamped with the arrival time of the fragment it started in, and that
+ * messages too large for the reassembly area are reported and skipped.
+ */
+static void test_framer_split(const char *name, const test_stream_t *stream, uint32_t max_fragment) {
+    base_message_t expected;
+    message_frame_t frame;
+    framer_t framer;
+    size_t index = 0, fragment, offset;
+    int64_t *arrivals;
+    long message = 0;
+    int result;
+
+    arrivals = malloc(stream->size * sizeof(int64_t));
+    if (!arrivals) {
+        return;
+    }
+
+    seed = max_fragment;
+    framer_init(&framer, frame_buffer, sizeof(frame_buffer));
+    while (index < stream->size) {
+        fragment = 1 + test_random(max_fragment);
+        if (fragment > stream->size - index) {
+            fragment = stream->size - index;
+        }
+        for (offset = index; offset < index + fragment; offset++) {
+            arrivals[offset] = 1000 + index;
+        }
+        framer_feed(&framer, stream->data + index, fragment, 1000 + index);
+        index += fragment;
+
+        while ((result = framer_next(&framer, &frame)) != 1) {
+            if (message == stream->messages) {
+                TEST_CHECK(0, "%s: message past the end of the stream", name);
+                goto done;
+            }
+            offset = stream->offsets[message];
+            base_message_deserialize(&expected, stream->data + offset, BASE_MESSAGE_SIZE);
+
+            TEST_CHECK(test_base_equals(&frame.base, &expected),
+                       "%s: message %ld header differs", name, message);
+            TEST_CHECK(frame.received_us == arrivals[offset],
+                       "%s: message %ld received at %lld, not %lld", name, message,
+                       (long long) frame.received_us, (long long) arrivals[offset]);
+            if (expected.size > MAX_PAYLOAD) {
+                TEST_CHECK(result == 2 && frame.payload == NULL,
+                           "%s: message %ld of %u bytes not dropped", name, message, expected.size);
+            } else {
+                TEST_CHECK(result == 0, "%s: message %ld of %u bytes dropped", name, message, expected.size);
+                TEST_CHECK(result != 0 || !memcmp(frame.payload, stream->data + offset + BASE_MESSAGE_SIZE,
+                                                  expected.size),
+                           "%s: message %ld payload differs", name, message);
+            }
+            if (test_failures) {
+                goto done;
+            }
+            message++;
+        }
+    }
+    TEST_CHECK(message == stream->messages, "%s: %ld of %ld messages", name, message, stream->messages);
+
+done:
+    free(arrivals);
+}
+
+static void test_framer_stream(const char *name, const test_stream_t *stream) {
+    static const uint32_t max_fragments[] = { 1, 3, 17, 64, 1460, 4096, 65536 };
+    char label[128];
+    size_t i;
+
+    for (i = 0; i < sizeof(max_fragments) / sizeof(max_fragments[0]); i++) {
+        snprintf(label, sizeof(label), "%s, fragments up to %u", name, max_fragments[i]);
+        test_framer_split(label, stream, max_fragments[i]);
+    }
+}
+
+void test_framer(void) {
+    test_stream_t stream;
+
+    stream.data = malloc(STREAM_SIZE);
+    if (!stream.data) {
+        TEST_CHECK(0, "out of memory");
+        return;
+    }
+    test_stream_build(&stream);
+    if (test_stream_index(&stream)) {
+        TEST_CHECK(0, "out of memory");
+        free(stream.data);
+        return;
+    }
+    test_framer_stream("framer", &stream);
+
+    free(stream.offsets);
+    free(stream.data);
+}
+
+int test_framer_file(const char *path) {
+    test_stream_t stream;
+    long size;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    stream.data = malloc(size);
+    if (!stream.data || fread(stream.data, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "%s: cannot read the stream\n", path);
+        free(stream.data);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    // a recorded stream may end in the middle of a message, which the
+    // framer then never returns
+    stream.size = size;
+    if (test_stream_index(&stream)) {
+        free(stream.data);
+        return 1;
+    }
+    stream.size = stream.messages ? stream.offsets[stream.messages - 1] : 0;
+    if (stream.messages) {
+        base_message_t base;
+
+        base_message_deserialize(&base, stream.data + stream.size, BASE_MESSAGE_SIZE);
+        stream.size += BASE_MESSAGE_SIZE + base.size;
+    }
+    printf("%s: %ld messages in %ld bytes\n", path, stream.messages, size);
+    test_framer_stream(path, &stream);
+
+    free(stream.offsets);
+    free(stream.data);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "test.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+
+/*
+ * Heap of a limited size, to exercise the out of memory paths. The test
+ * binary is linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free.
+ */
+
+long test_heap_limit = -1;
+long test_heap_used;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static int test_heap_full(size_t size) {
+    return test_heap_limit >= 0 && test_heap_used + (long) size > test_heap_limit;
+}
+
+static void *test_heap_track(void *ptr) {
+    if (ptr) {
+        test_heap_used += malloc_usable_size(ptr);
+    }
+    return ptr;
+}
+
+void *__wrap_malloc(size_t size) {
+    return test_heap_full(size) ? NULL : test_heap_track(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    return test_heap_full(count * size) ? NULL : test_heap_track(__real_calloc(count, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    size_t used = ptr ? malloc_usable_size(ptr) : 0;
+    void *result;
+
+    if (test_heap_full(size)) {
+        return NULL;
+    }
+    result = __real_realloc(ptr, size);
+    if (result) {
+        test_heap_used -= used;
+        test_heap_track(result);
+    }
+    return result;
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr) {
+        test_heap_used -= malloc_usable_size(ptr);
+    }
+    __real_free(ptr);
+}
@@ -0,0 +1,135 @@
+#include "test.h"
+
+#include <jitter_buffer.h>
+#include <snapclient_clock.h>
+#include <string.h>
+
+#define JITTER_CHUNK_US 20000
+#define JITTER_CHUNK_SIZE 3840
+
+static char chunk_payload[JITTER_CHUNK_SIZE];
+
+static int jitter_push(jitter_buffer_t *jb, long index) {
+    wire_chunk_message_t chunk;
+    int result;
+
+    memset(&chunk, 0, sizeof(chunk));
+    chunk.timestamp = tv_from_us(index * JITTER_CHUNK_US);
+    chunk.size = JITTER_CHUNK_SIZE;
+    chunk.payload = chunk_payload;
+    result = jitter_buffer_push(jb, &chunk);
+    if (result) {
+        wire_chunk_message_free(&chunk);
+    }
+    return result;
+}
+
+/*
+ * With the heap exhausted before the byte ceiling, the oldest chunks make
+ * room for the new ones and count as overflows, and a chunk that fits
+ * nowhere is reported and counted too.
+ */
+static void test_jitter_buffer_out_of_heap(void) {
+    static jitter_buffer_t jb;
+    uint32_t overflows;
+    long i;
+
+    jitter_buffer_init(&jb, 64, 64 * JITTER_CHUNK_SIZE);
+    test_heap_limit = test_heap_used + 10 * (JITTER_CHUNK_SIZE + 64);
+    for (i = 0; i < 30; i++) {
+        TEST_CHECK(jitter_push(&jb, i) == 0, "chunk %ld not pushed", i);
+    }
+    TEST_CHECK(jb.count >= 8 && jb.count <= 10, "%zu chunks held", jb.count);
+    TEST_CHECK(jb.stats.overflows == 30 - jb.count, "%u overflows for %zu chunks held",
+               jb.stats.overflows, jb.count);
+    TEST_CHECK(jitter_buffer_peek(&jb)->timestamp_us == (int64_t) (30 - jb.count) * JITTER_CHUNK_US,
+               "oldest chunk at %lld us", (long long) jitter_buffer_peek(&jb)->timestamp_us);
+
+    jitter_buffer_clear(&jb);
+    overflows = jb.stats.overflows;
+    test_heap_limit = test_heap_used;
+    TEST_CHECK(jitter_push(&jb, 30) == 2, "chunk pushed without heap");
+    TEST_CHECK(jb.stats.overflows == overflows + 1, "drop not counted");
+    test_heap_limit = -1;
+    jitter_buffer_deinit(&jb);
+}
+
+/*
+ * A deserialized chunk is a view on the read buffer until it is pushed: the
+ * jitter buffer then holds its own copy, which survives the read buffer
+ * being reused and goes away with the entry.
+ */
+static void test_jitter_buffer_ownership(void) {
+    static jitter_buffer_t jb;
+    char data[WIRE_CHUNK_HEADER_SIZE + 16];
+    wire_chunk_message_t chunk = { 0 };
+    jitter_buffer_entry_t *entry;
+    write_buffer_t buffer;
+    long heap_used;
+
+    chunk.timestamp = tv_from_us(JITTER_CHUNK_US);
+    chunk.size = 16;
+    buffer_write_init(&buffer, data, sizeof(data));
+    wire_chunk_header_encode(&chunk, &buffer);
+    memset(data + WIRE_CHUNK_HEADER_SIZE, 'a', 16);
+
+    jitter_buffer_init(&jb, 4, 4 * JITTER_CHUNK_SIZE);
+    heap_used = test_heap_used;
+    TEST_CHECK(wire_chunk_message_deserialize(&chunk, data, sizeof(data)) == 0, "chunk not read");
+    TEST_CHECK(chunk.chunk == NULL && chunk.payload == data + WIRE_CHUNK_HEADER_SIZE,
+               "deserialized payload is not a view on the read buffer");
+    TEST_CHECK(jitter_buffer_push(&jb, &chunk) == 0, "chunk not pushed");
+    TEST_CHECK(chunk.chunk == NULL && chunk.payload == NULL, "pushed chunk still held by the caller");
+
+    memset(data + WIRE_CHUNK_HEADER_SIZE, 'b', 16);
+    entry = jitter_buffer_peek(&jb);
+    TEST_CHECK(entry && entry->chunk.chunk && entry->chunk.payload == entry->chunk.chunk->data,
+               "buffered chunk does not own its payload");
+    TEST_CHECK(entry && entry->chunk.payload[0] == 'a' && entry->chunk.payload[15] == 'a',
+               "buffered payload follows the read buffer");
+    TEST_CHECK(entry && wire_chunk_message_own(&(entry->chunk)) == 0 && test_heap_used > heap_used,
+               "owning an owned chunk failed");
+
+    jitter_buffer_pop(&jb);
+    TEST_CHECK(test_heap_used == heap_used, "%ld bytes left after the pop", test_heap_used - heap_used);
+    jitter_buffer_deinit(&jb);
+}
+
+/*
+ * Compressed chunks cannot be cut: a start waits for a head chunk due within
+ * the lead and skips the overdue ones, so playback is always on schedule.
+ */
+static void test_jitter_buffer_start_compressed(void) {
+    static jitter_buffer_t jb;
+    jitter_buffer_start_t start;
+    jitter_buffer_entry_t *entry;
+    int64_t now_us, lead_us = 1000;
+    long i;
+
+    jitter_buffer_init(&jb, 16, 16 * JITTER_CHUNK_SIZE);
+    for (now_us = -JITTER_CHUNK_US; now_us < 5 * JITTER_CHUNK_US; now_us += 333) {
+        jitter_buffer_clear(&jb);
+        for (i = 0; i < 8; i++) {
+            jitter_push(&jb, i);
+        }
+        entry = jitter_buffer_start(&jb, now_us, lead_us, 48000, 0, &start);
+        if (!entry) {
+            TEST_CHECK(jitter_buffer_peek(&jb)->timestamp_us > now_us + lead_us,
+                       "start at %lld us waits for a due chunk", (long long) now_us);
+            continue;
+        }
+        TEST_CHECK(start.error_ns == 0,
+                   "start at %lld us off by %lld ns", (long long) now_us, (long long) start.error_ns);
+        TEST_CHECK(start.wait_us >= 0 && now_us + start.wait_us == start.play_us,
+                   "start at %lld us waits %lld us for %lld us", (long long) now_us,
+                   (long long) start.wait_us, (long long) start.play_us);
+        TEST_CHECK(entry->timestamp_us == start.play_us, "start reports another chunk");
+    }
+    jitter_buffer_deinit(&jb);
+}
+
+void test_jitter_buffer(void) {
+    test_jitter_buffer_start_compressed();
+    test_jitter_buffer_out_of_heap();
+    test_jitter_buffer_ownership();
+}
@@ -0,0 +1,32 @@
+/*
+ * Host unit tests for the portable protocol and sync code, see
+ * host/CMakeLists.txt. Recorded streams given as arguments are split at
+ * random and checked through the framer too.
+ */
+
+#include "test.h"
+
+int test_failures;
+
+int main(int argc, char **argv) {
+    int i;
+
+    test_framer();
+    test_stream_tags();
+    test_time_sync();
+    test_jitter_buffer();
+    test_playout();
+
+    for (i = 1; i < argc; i++) {
+        if (test_framer_file(argv[i])) {
+            return 1;
+        }
+    }
+
+    if (test_failures) {
+        printf("%d checks failed\n", test_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "test.h"
+
+#include <playout.h>
+
+#define PLAYOUT_RATE 48000
+#define PLAYOUT_DMA_US 40000       // as CONFIG_SNAPCLIENT_I2S_LATENCY_MS
+#define PLAYOUT_FILL_US 40000      // as SNAPCLIENT_STREAM_GAP_FILL_MS
+#define PLAYOUT_FADE_US 5333       // SNAPCLIENT_STREAM_FADE_FRAMES at 48 kHz
+#define PLAYOUT_POLL_US 20000      // as SNAPCLIENT_STREAM_POLL_MS
+
+/*
+ * During a gap, the DMA buffers stay full while the ring buffers drain:
+ * silence must top the ring buffers up to the fill level whatever the DMA
+ * depth, even when it alone exceeds that level.
+ */
+static void test_playout_gap(void) {
+    playout_level_t level = { .now_us = 1000000, .fixed_us = PLAYOUT_DMA_US };
+    uint32_t frames;
+
+    level.play_now_us = level.now_us + PLAYOUT_DMA_US;
+    frames = playout_gap_frames(&level, PLAYOUT_FILL_US, PLAYOUT_RATE);
+    TEST_CHECK(frames == PLAYOUT_FILL_US / 1000 * PLAYOUT_RATE / 1000,
+               "%u silence frames with empty ring buffers", frames);
+
+    level.play_now_us = level.now_us + PLAYOUT_DMA_US + 15000;
+    frames = playout_gap_frames(&level, PLAYOUT_FILL_US, PLAYOUT_RATE);
+    TEST_CHECK(frames == 25 * PLAYOUT_RATE / 1000, "%u silence frames with 15 ms buffered", frames);
+
+    level.play_now_us = level.now_us + PLAYOUT_DMA_US + PLAYOUT_FILL_US;
+    frames = playout_gap_frames(&level, PLAYOUT_FILL_US, PLAYOUT_RATE);
+    TEST_CHECK(frames == 0, "%u silence frames with the ring buffers filled", frames);
+
+    // a frame count racing the clock may look below the DMA depth
+    level.play_now_us = level.now_us + PLAYOUT_DMA_US - 1000;
+    TEST_CHECK(playout_buffered_us(&level) == 0, "%lld us buffered below the DMA depth",
+               (long long) playout_buffered_us(&level));
+}
+
+/*
+ * The last chunk is held while the ring buffers cover its fade out and a
+ * poll period, whatever the DMA depth, and goes as soon as they do not.
+ */
+static void test_playout_hold(void) {
+    playout_level_t level = { .now_us = 1000000, .fixed_us = PLAYOUT_DMA_US };
+    int64_t hold_us;
+
+    level.play_now_us = level.now_us + PLAYOUT_DMA_US + 100000;
+    hold_us = playout_hold_us(&level, PLAYOUT_FADE_US, PLAYOUT_POLL_US);
+    TEST_CHECK(hold_us == 100000 - PLAYOUT_FADE_US - PLAYOUT_POLL_US,
+               "held %lld us with 100 ms buffered", (long long) hold_us);
+
+    level.play_now_us = level.now_us + PLAYOUT_DMA_US + PLAYOUT_FADE_US + PLAYOUT_POLL_US;
+    hold_us = playout_hold_us(&level, PLAYOUT_FADE_US, PLAYOUT_POLL_US);
+    TEST_CHECK(hold_us == 0, "held %lld us with only the fade and a poll buffered", (long long) hold_us);
+
+    // the DMA buffers alone do not let a chunk wait
+    level.play_now_us = level.now_us + PLAYOUT_DMA_US;
+    hold_us = playout_hold_us(&level, PLAYOUT_FADE_US, PLAYOUT_POLL_US);
+    TEST_CHECK(hold_us == 0, "held %lld us with empty ring buffers", (long long) hold_us);
+}
+
+void test_playout(void) {
+    test_playout_gap();
+    test_playout_hold();
+}
@@ -0,0 +1,107 @@
+#include "test.h"
+
+#include <buffer.h>
+#include <snapcast.h>
+#include <string.h>
+
+/*
+ * Artist arrays joined past STREAM_TAGS_FIELD_MAX: whatever the element
+ * lengths, the field must be a prefix of the fully joined list, never two
+ * names run together nor a dangling separator, and be flagged truncated
+ * when anything is missing.
+ */
+static stream_tags_message_t scratch;
+
+static int test_stream_tags_parse(stream_tags_message_t *tags, char *payload, const char *json) {
+    size_t json_size = strlen(json);
+
+    buffer_store_uint32(payload, json_size);
+    memcpy(payload + 4, json, json_size);
+    return stream_tags_message_deserialize(tags, &scratch, payload, 4 + json_size);
+}
+
+static void test_stream_tags_artists(size_t length, int count) {
+    static stream_tags_message_t tags;
+    char payload[2048], joined[1024];
+    size_t json_size = 0, joined_size = 0, size;
+    int i;
+
+    json_size += sprintf(payload + 4 + json_size, "{\"xesam:artist\":[");
+    for (i = 0; i < count; i++) {
+        if (i) {
+            payload[4 + json_size++] = ',';
+            joined_size += sprintf(joined + joined_size, ", ");
+        }
+        payload[4 + json_size++] = '"';
+        memset(payload + 4 + json_size, 'a' + i % 26, length);
+        memset(joined + joined_size, 'a' + i % 26, length);
+        json_size += length;
+        joined_size += length;
+        payload[4 + json_size++] = '"';
+    }
+    json_size += sprintf(payload + 4 + json_size, "]}");
+    joined[joined_size] = '\0';
+    buffer_store_uint32(payload, json_size);
+
+    TEST_CHECK(stream_tags_message_deserialize(&tags, &scratch, payload, 4 + json_size) == 0,
+               "%d artists of %zu bytes not parsed", count, length);
+    size = strlen(tags.artist);
+    TEST_CHECK(size < STREAM_TAGS_FIELD_MAX, "%zu bytes for at most %d", size, STREAM_TAGS_FIELD_MAX);
+    TEST_CHECK(!strncmp(tags.artist, joined, size),
+               "%d artists of %zu bytes joined as \"%s\"", count, length, tags.artist);
+    TEST_CHECK(size < 2 || strcmp(tags.artist + size - 2, ", "),
+               "%d artists of %zu bytes end with a separator", count, length);
+    TEST_CHECK(tags.truncated == (size != joined_size),
+               "%d artists of %zu bytes: %zu of %zu bytes, truncated %d", count, length,
+               size, joined_size, tags.truncated);
+}
+
+// A malformed payload leaves the tags as they were
+static void test_stream_tags_malformed(void) {
+    static stream_tags_message_t tags;
+    char payload[256];
+
+    stream_tags_message_init(&tags);
+    TEST_CHECK(test_stream_tags_parse(&tags, payload, "{\"title\":\"Song\",\"artist\":[\"A\",\"B\"]}") == 0,
+               "tags not parsed");
+    TEST_CHECK(test_stream_tags_parse(&tags, payload, "{\"title\":\"Other\",\"artist\":") == 1,
+               "malformed tags parsed");
+    TEST_CHECK(!strcmp(tags.title, "Song") && !strcmp(tags.artist, "A, B"),
+               "tags now \"%s\" by \"%s\"", tags.title, tags.artist);
+    TEST_CHECK(tags.title >= tags.arena && tags.title < tags.arena + sizeof(tags.arena),
+               "title points out of the tags arena");
+}
+
+// An art URL over the field limit is dropped, not cut into a broken one
+static void test_stream_tags_art_url(void) {
+    static stream_tags_message_t tags;
+    char payload[1024], json[768];
+    size_t size;
+
+    size = sprintf(json, "{\"mpris:artUrl\":\"http://art/");
+    memset(json + size, 'x', STREAM_TAGS_FIELD_MAX);
+    size += STREAM_TAGS_FIELD_MAX;
+    sprintf(json + size, "\",\"title\":\"Song\"}");
+
+    TEST_CHECK(test_stream_tags_parse(&tags, payload, json) == 0, "tags not parsed");
+    TEST_CHECK(!strcmp(tags.art_url, ""), "art URL kept as %zu bytes", strlen(tags.art_url));
+    TEST_CHECK(tags.truncated, "dropped art URL not flagged");
+    TEST_CHECK(!strcmp(tags.title, "Song"), "title \"%s\" after a dropped art URL", tags.title);
+
+    TEST_CHECK(test_stream_tags_parse(&tags, payload, "{\"artUrl\":\"http://art/1.jpg\"}") == 0,
+               "tags not parsed");
+    TEST_CHECK(!strcmp(tags.art_url, "http://art/1.jpg") && !tags.truncated,
+               "art URL read as \"%s\"", tags.art_url);
+}
+
+void test_stream_tags(void) {
+    size_t length;
+
+    test_stream_tags_malformed();
+    test_stream_tags_art_url();
+
+    for (length = 1; length < 80; length++) {
+        test_stream_tags_artists(length, 3);
+        test_stream_tags_artists(length, 12);
+    }
+}
@@ -0,0 +1,149 @@
+#include "test.h"
+
+#include <time_sync.h>
+#include <sync_scheduler.h>
+#include <stdlib.h>
+
+#define SYNC_SAMPLES 2000
+#define SYNC_FILL 10            // samples before the error is checked
+#define SYNC_WARMUP 300         // samples before the skew is checked, 5 minutes
+#define SYNC_TOLERANCE_US 500   // average and 95th percentile error
+#define SYNC_MAX_ERROR_US 2500  // worst error, half of a congested wifi queue
+#define SYNC_SKEW_TOLERANCE_PPM 2.0
+
+typedef struct sync_scenario {
+    const char *name;
+    int64_t base_us;        // one way network latency
+    int64_t jitter_us;      // always present jitter
+    int congestion;         // percentage of delays hitting a queue
+    int64_t queue_us;       // worst queuing delay
+    double skew_ppm;        // server clock rate error
+} sync_scenario_t;
+
+static const sync_scenario_t scenarios[] = {
+    { "lan", 500, 200, 0, 0, 0 },
+    { "wifi", 2000, 1000, 10, 20000, 0 },
+    { "congested wifi", 2000, 2000, 40, 80000, 0 },
+    { "wifi, 40 ppm skew", 2000, 1000, 10, 20000, 40 },
+    { "congested wifi, -80 ppm skew", 2000, 2000, 40, 80000, -80 },
+    { "asymmetric wifi, 200 ppm skew", 1000, 3000, 25, 40000, 200 },
+};
+
+static uint32_t seed;
+
+static int64_t sync_random(int64_t max) {
+    seed = seed * 1103515245 + 12345;
+    return max ? (int64_t) (seed >> 8) % max : 0;
+}
+
+static int64_t sync_delay(const sync_scenario_t *scenario) {
+    int64_t delay = scenario->base_us + sync_random(scenario->jitter_us);
+
+    if (sync_random(100) < scenario->congestion) {
+        delay += sync_random(scenario->queue_us);
+    }
+    return delay;
+}
+
+static int64_t sync_offset(const sync_scenario_t *scenario, int64_t local) {
+    return 123456789 + (int64_t) (local * scenario->skew_ppm / 1e6);
+}
+
+static int sync_compare(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Time message exchanges once a second with independent jitter on each
+ * direction. The server time given by the estimator half way to the next
+ * exchange must stay within the tolerance, and within a few ms at worst
+ * once the skew is found. Until then a fast drifting server clock runs away
+ * from the window median.
+ */
+static void test_time_sync_scenario(const sync_scenario_t *scenario) {
+    static time_sync_t sync;
+    static int64_t errors[SYNC_SAMPLES];
+    int64_t local = 1000000, c2s, s2c, error, sum = 0, worst = 0;
+    double skew;
+    int i, count = 0;
+
+    seed = 1;
+    time_sync_init(&sync);
+    TEST_CHECK(!time_sync_is_valid(&sync), "%s: valid without samples", scenario->name);
+
+    for (i = 0; i < SYNC_SAMPLES; i++) {
+        local += 1000000;
+        c2s = sync_offset(scenario, local) + sync_delay(scenario);
+        s2c = sync_delay(scenario) - sync_offset(scenario, local);
+        TEST_CHECK(time_sync_add(&sync, local, c2s, s2c) == 0, "%s: sample %d rejected", scenario->name, i);
+
+        if (i >= SYNC_FILL) {
+            error = llabs(time_sync_server_time(&sync, local + 500000) - local - 500000
+                          - sync_offset(scenario, local + 500000));
+            errors[count++] = error;
+            sum += error;
+        }
+        if (i >= SYNC_WARMUP && error > worst) {
+            worst = error;
+        }
+
+        if (i >= SYNC_WARMUP) {
+            skew = time_sync_skew_ppm(&sync);
+            if (skew < scenario->skew_ppm - SYNC_SKEW_TOLERANCE_PPM
+                || skew > scenario->skew_ppm + SYNC_SKEW_TOLERANCE_PPM) {
+                TEST_CHECK(0, "%s: skew %.1f ppm after %d samples, not %.1f", scenario->name,
+                           skew, i + 1, scenario->skew_ppm);
+                return;
+            }
+        }
+    }
+
+    qsort(errors, count, sizeof(errors[0]), sync_compare);
+    TEST_CHECK(sum / count < SYNC_TOLERANCE_US, "%s: %lld us average error",
+               scenario->name, (long long) (sum / count));
+    TEST_CHECK(errors[count * 95 / 100] < SYNC_TOLERANCE_US, "%s: %lld us 95th percentile error",
+               scenario->name, (long long) errors[count * 95 / 100]);
+    TEST_CHECK(worst < SYNC_MAX_ERROR_US, "%s: %lld us worst error once the skew is known",
+               scenario->name, (long long) worst);
+}
+
+// Exchanges where the reply beats the request are impossible and dropped
+static void test_time_sync_reject(void) {
+    static time_sync_t sync;
+
+    time_sync_init(&sync);
+    TEST_CHECK(time_sync_add(&sync, 1000000, 1000, -2000) == 1, "negative round trip accepted");
+    TEST_CHECK(!time_sync_is_valid(&sync), "valid from a rejected sample");
+    TEST_CHECK(time_sync_server_time(&sync, 1234) == 1234, "server time without samples");
+}
+
+/*
+ * Replies to burst requests arriving up to SYNC_SCHEDULER_MAX_RTT_MS late,
+ * after many more requests went out, are still matched, once.
+ */
+static void test_sync_scheduler_slow_replies(void) {
+    static sync_scheduler_t scheduler;
+    uint32_t late = SYNC_SCHEDULER_MAX_RTT_MS / SYNC_SCHEDULER_BURST_INTERVAL_MS;
+    uint16_t id;
+
+    sync_scheduler_init(&scheduler);
+    for (id = 0; id <= late; id++) {
+        sync_scheduler_sent(&scheduler, id);
+    }
+    TEST_CHECK(sync_scheduler_reply(&scheduler, 0, 0, false) == 0,
+               "reply after %u ms not matched", late * SYNC_SCHEDULER_BURST_INTERVAL_MS);
+    TEST_CHECK(sync_scheduler_reply(&scheduler, 0, 0, false) == -1, "duplicate reply matched");
+    TEST_CHECK(sync_scheduler_reply(&scheduler, id, 0, false) == -1, "reply to an unsent request matched");
+}
+
+void test_time_sync(void) {
+    size_t s;
+
+    for (s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        test_time_sync_scenario(&scenarios[s]);
+    }
+    test_time_sync_reject();
+    test_sync_scheduler_slow_replies();
+}
@@ -24,6 +24,8 @@
 #include "audio_common.h"
 #include "i2s_stream.h"
 #include "snapclient_stream.h"
+#include "drift_resampler.h"
+#include "playback_position.h"
 #include "opus_decoder.h"
 #include "filter_resample.h"
 
@@ -32,8 +34,47 @@
 #include "esp_peripherals.h"
 #include "periph_wifi.h"
 #include "board.h"
+#include "board_pins_config.h"
 
 static const char *TAG = "SNAPCAST";
+
+// frames between the snapclient stream and the DAC
+static playback_position_t playback_position;
+
+/*
+ * The I2S driver only takes the DMA buffer count and length when installed,
+ * in frames: install it again when a sample format needs other ones.
+ */
+static esp_err_t i2s_dma_reconfigure(audio_element_handle_t i2s_stream, i2s_stream_cfg_t *i2s_cfg,
+                                     int dma_buf_count, int dma_buf_len)
+{
+    audio_element_state_t state = audio_element_get_state(i2s_stream);
+    int old_count = i2s_cfg->i2s_config.dma_buf_count, old_len = i2s_cfg->i2s_config.dma_buf_len;
+    i2s_pin_config_t pin_config;
+    esp_err_t err;
+
+    // the writer must not be in i2s_write meanwhile
+    if (state == AEL_STATE_RUNNING) {
+        audio_element_pause(i2s_stream);
+    }
+    i2s_driver_uninstall(i2s_cfg->i2s_port);
+    i2s_cfg->i2s_config.dma_buf_count = dma_buf_count;
+    i2s_cfg->i2s_config.dma_buf_len = dma_buf_len;
+    err = i2s_driver_install(i2s_cfg->i2s_port, &i2s_cfg->i2s_config, 0, NULL);
+    if (err != ESP_OK) {
+        // keep playing with the buffers that worked
+        i2s_cfg->i2s_config.dma_buf_count = old_count;
+        i2s_cfg->i2s_config.dma_buf_len = old_len;
+        i2s_driver_install(i2s_cfg->i2s_port, &i2s_cfg->i2s_config, 0, NULL);
+    }
+    get_i2s_pins(i2s_cfg->i2s_port, &pin_config);
+    i2s_set_pin(i2s_cfg->i2s_port, &pin_config);
+    if (state == AEL_STATE_RUNNING) {
+        audio_element_resume(i2s_stream, 0, 0);
+    }
+    return err;
+}
+
 /*
    To embed it in the app binary, the mp3 file is named
    in the component.mk COMPONENT_EMBED_TXTFILES variable.
@@ -63,7 +104,7 @@ static void wait_for_sntp(void)
 void app_main(void)
 {
     audio_pipeline_handle_t pipeline;
-    audio_element_handle_t i2s_stream_writer, opus_decoder, snapclient_stream;
+    audio_element_handle_t i2s_stream_writer, opus_decoder, snapclient_stream, drift_resampler;
 
 	// setup logging
     esp_log_level_set("*", ESP_LOG_INFO);
@@ -96,26 +137,50 @@ void app_main(void)
 	snapclient_cfg.port = CONFIG_SNAPSERVER_PORT;
 	snapclient_cfg.host = CONFIG_SNAPSERVER_HOST;
 	// TODO buff len & client name
+	// no decoder is linked yet, the stream refuses anything but pcm
+	// rather than feeding compressed chunks to the resampler
+	snapclient_cfg.decoder = false;
     snapclient_stream = snapclient_stream_init(&snapclient_cfg);
 
     //ESP_LOGI(TAG, "[2.1] Create opus decoder");
     //opus_decoder_cfg_t opus_cfg = DEFAULT_OPUS_DECODER_CONFIG();
     //opus_decoder = decoder_opus_init(&opus_cfg);
 
+    ESP_LOGI(TAG, "[2.1] Create drift resampler, following the server clock");
+    drift_resampler_cfg_t drift_cfg = DRIFT_RESAMPLER_CFG_DEFAULT();
+    drift_cfg.skew_ppm = snapclient_clock_skew_ppm;
+    drift_resampler = drift_resampler_init(&drift_cfg);
+
     ESP_LOGI(TAG, "[2.2] Create i2s stream to write data to codec chip");
     i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
     i2s_cfg.type = AUDIO_STREAM_WRITER;
+    // DMA buffers sized for the latency target, at the usual 48kHz 16 bits
+    // stereo until the stream reports its sample format
+    int dma_buf_count, dma_buf_len;
+    playback_position_dma_config(48000, 4, CONFIG_SNAPCLIENT_I2S_LATENCY_MS,
+                                 &dma_buf_count, &dma_buf_len);
+    i2s_cfg.i2s_config.dma_buf_count = dma_buf_count;
+    i2s_cfg.i2s_config.dma_buf_len = dma_buf_len;
+    ESP_LOGI(TAG, "I2S DMA: %d buffers of %d frames", dma_buf_count, dma_buf_len);
     i2s_stream_writer = i2s_stream_init(&i2s_cfg);
 
     ESP_LOGI(TAG, "[2.3] Register all elements to audio pipeline");
     audio_pipeline_register(pipeline, snapclient_stream, "snapclient");
     //audio_pipeline_register(pipeline, opus_decoder, "opus");
+    audio_pipeline_register(pipeline, drift_resampler, "drift");
     audio_pipeline_register(pipeline, i2s_stream_writer, "i2s");
 
     ESP_LOGI(TAG, "[2.4] Link it together");
 
-    const char *link_tag[2] = {"snapclient", "i2s"};
-    audio_pipeline_link(pipeline, &link_tag[0], 2);
+    const char *link_tag[3] = {"snapclient", "drift", "i2s"};
+    audio_pipeline_link(pipeline, &link_tag[0], 3);
+
+    // the stream releases chunks early by what is queued after it
+    playback_position_init(&playback_position, i2s_stream_writer, dma_buf_count, dma_buf_len);
+    playback_position_add(&playback_position, drift_resampler);
+    playback_position_add(&playback_position, i2s_stream_writer);
+    snapclient_stream_set_downstream(snapclient_stream, playback_position_frames, &playback_position,
+                                     playback_position_fixed_frames(&playback_position));
 
     ESP_LOGI(TAG, "[ 3 ] Start and wait for Wi-Fi network");
     esp_periph_config_t periph_cfg = DEFAULT_ESP_PERIPH_SET_CONFIG();
@@ -162,8 +227,6 @@ void app_main(void)
     ESP_LOGI(TAG, "[ 5 ] Start audio_pipeline");
     audio_pipeline_run(pipeline);
 
-	i2s_stream_set_clk(i2s_stream_writer, 48000 , 16, 2);
-
     while (1) {
 		/*
         AEL_MSG_CMD_NONE                = 0,
@@ -193,6 +256,8 @@ void app_main(void)
 		//else
 		if (msg.source == (void *) snapclient_stream)
 			sprintf(source, "%s", "snapclient");
+		else if (msg.source == (void *) drift_resampler)
+			sprintf(source, "%s", "drift");
 		else if (msg.source == (void *) i2s_stream_writer)
 			sprintf(source, "%s", "i2s");
 		else
@@ -269,8 +334,29 @@ void app_main(void)
                      music_info.sample_rates, music_info.bits, music_info.channels);
 
             //audio_element_setinfo(opus_decoder, &music_info);
+            audio_element_setinfo(drift_resampler, &music_info);
             audio_element_setinfo(i2s_stream_writer, &music_info);
 
+            // keep the DMA latency on target and its buffers within the
+            // driver byte limit, then tell the stream what it now holds
+            int count = dma_buf_count, len = dma_buf_len;
+            if (music_info.bits && music_info.channels) {
+                playback_position_dma_config(music_info.sample_rates, music_info.bits / 8 * music_info.channels,
+                                             CONFIG_SNAPCLIENT_I2S_LATENCY_MS, &count, &len);
+            }
+            if (count != dma_buf_count || len != dma_buf_len) {
+                if (i2s_dma_reconfigure(i2s_stream_writer, &i2s_cfg, count, len) == ESP_OK) {
+                    dma_buf_count = count;
+                    dma_buf_len = len;
+                    ESP_LOGI(TAG, "I2S DMA: %d buffers of %d frames", dma_buf_count, dma_buf_len);
+                } else {
+                    ESP_LOGE(TAG, "Failed to resize the I2S DMA buffers");
+                }
+                playback_position_set_dma(&playback_position, dma_buf_count, dma_buf_len);
+                snapclient_stream_set_downstream(snapclient_stream, playback_position_frames, &playback_position,
+                                                 playback_position_fixed_frames(&playback_position));
+            }
+
             i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates , music_info.bits, music_info.channels);
             continue;
         }
@@ -307,6 +393,7 @@ void app_main(void)
 
 	audio_pipeline_unregister(pipeline, snapclient_stream);
     //audio_pipeline_unregister(pipeline, opus_decoder);
+    audio_pipeline_unregister(pipeline, drift_resampler);
     audio_pipeline_unregister(pipeline, i2s_stream_writer);
 
     /* Terminate the pipeline before removing the listener */
@@ -323,5 +410,6 @@ void app_main(void)
     audio_pipeline_deinit(pipeline);
     audio_element_deinit(i2s_stream_writer);
     //audio_element_deinit(opus_decoder);
+    audio_element_deinit(drift_resampler);
     audio_element_deinit(snapclient_stream);
 }